@@ -0,0 +1,186 @@
+/**
+ *  @file   binarize.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Microbenchmark comparing the original per-sample
+ *  binarize loop against the run-length RunEncoder, fed
+ *  floats and the same signal as native int16 samples.
+ *
+ */
+
+#include "RunEncoder.h"
+#include "record.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+
+#define BENCH_SECONDS   (60)
+#define BENCH_ROUNDS    (5)
+
+// The gap between codes, in samples
+#define BENCH_GAP       (SAMPLE_RATE*ZERO_PREAMBLE_TIME)
+
+static double now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+};
+
+static float noise(float level) {
+  return level * ((rand() / (float)RAND_MAX) * 2 - 1);
+};
+
+/**
+ *  Fills ``buffer`` with low-level noise and, for ``duty`` of
+ *  the time, bursts of a typical 16 bit code.
+ */
+static void generate(vector<float>& buffer, double duty) {
+  const int pulses[4] = {21, 84, 74, 31};  // hi-short, lo-long, hi-long, lo-short
+  const char* code    = "0110100010000100";
+  int         frame   = 0;
+  
+  buffer.clear();
+  
+  while (buffer.size() < (size_t)(BENCH_SECONDS*SAMPLE_RATE))
+  {
+    bool burst = (frame++ % 100) < duty*100;
+    
+    for (const char* c = code; *c; c++) {
+      int hi = (*c == '1') ? pulses[2] : pulses[0];
+      int lo = (*c == '1') ? pulses[3] : pulses[1];
+      
+      for (int i=0; i < hi; i++) {
+        buffer.push_back(burst ? 0.5f + noise(0.05f) : noise(0.01f));
+      }
+      for (int i=0; i < lo; i++) {
+        buffer.push_back(noise(0.01f));
+      }
+    }
+    
+    for (int i=0; i < 700; i++) {
+      buffer.push_back(noise(0.01f));
+    }
+  }
+};
+
+/**
+ *  The loop previously used by Sampler::sample: binarize each
+ *  sample, count consecutive zeroes and extend the current run.
+ */
+static long legacy(const float* buffer, int length, int* counts) {
+  long  checksum  = 0;
+  int   zeroes    = 0;
+  int   last      = -1;
+  int   runs      = 0;
+  
+  for (int j=0; j < length; j++) {
+    int value = (buffer[j] <= SIGNAL_THRESH) ? 0 : 1;
+    
+    if (value == 1) {
+      zeroes = 0;
+    } else {
+      zeroes++;
+    }
+    
+    if (zeroes >= BENCH_GAP) {
+      checksum++;
+      zeroes = 0;
+    }
+    
+    if (value != last) {
+      runs = (runs + 1) % FRAMES_PER_BUFFER;
+      counts[runs] = 0;
+    }
+    counts[runs]++;
+    last = value;
+  }
+  
+  return checksum + runs;
+};
+
+template <typename T>
+static long encoded(RunEncoder& encoder, const T* buffer, int length, Run* runs) {
+  long  checksum  = 0;
+  int   count     = encoder.encode(buffer, length, runs);
+  
+  for (int j=0; j < count; j++) {
+    if (runs[j].level == 0 && runs[j].length >= BENCH_GAP) {
+      checksum++;
+    }
+  }
+  
+  return checksum + count;
+};
+
+static void run(const char* name, double duty, int block) {
+  vector<float>   buffer;
+  vector<int16_t> native;
+  vector<Run>     runs(block);
+  vector<int>     counts(FRAMES_PER_BUFFER);
+  double          best[3] = {1e9, 1e9, 1e9};
+  long            checksum = 0,
+                  encoder_sum = 0,
+                  native_sum = 0;
+  
+  generate(buffer, duty);
+  int length = (int)buffer.size() - (int)buffer.size() % block;
+  
+  // The same signal as a 16-bit interface would deliver it
+  for (size_t i=0; i < buffer.size(); i++) {
+    native.push_back(SampleTraits<int16_t>::fromLevel(buffer[i]));
+    buffer[i] = SampleTraits<int16_t>::toLevel(native[i]);
+  }
+  
+  for (int r=0; r < BENCH_ROUNDS; r++) {
+    double start = now();
+    for (int i=0; i < length; i += block) {
+      checksum += legacy(&buffer[i], block, &counts[0]);
+    }
+    double t = now() - start;
+    if (t < best[0]) best[0] = t;
+    
+    RunEncoder encoder(SIGNAL_THRESH);
+    start = now();
+    for (int i=0; i < length; i += block) {
+      encoder_sum += encoded(encoder, &buffer[i], block, &runs[0]);
+    }
+    t = now() - start;
+    if (t < best[1]) best[1] = t;
+    
+    RunEncoder native_encoder(SIGNAL_THRESH);
+    start = now();
+    for (int i=0; i < length; i += block) {
+      native_sum += encoded(native_encoder, &native[i], block, &runs[0]);
+    }
+    t = now() - start;
+    if (t < best[2]) best[2] = t;
+  }
+  
+  double audio = length / SAMPLE_RATE;
+  
+  printf("{\"bench\":\"binarize\",\"case\":\"%s\",\"block\":%d,\"kernel\":\"%s\","
+         "\"legacy_ns_per_sample\":%.3f,\"encoder_ns_per_sample\":%.3f,\"s16_ns_per_sample\":%.3f,"
+         "\"legacy_us_per_audio_s\":%.1f,\"encoder_us_per_audio_s\":%.1f,\"s16_us_per_audio_s\":%.1f,"
+         "\"speedup\":%.1f,\"s16_speedup\":%.1f,\"s16_matches\":%s,\"checksum\":%ld}\n",
+         name, block, RunEncoder::getKernelName(),
+         best[0]/length*1e9, best[1]/length*1e9, best[2]/length*1e9,
+         best[0]/audio*1e6, best[1]/audio*1e6, best[2]/audio*1e6,
+         best[0]/best[1], best[1]/best[2], encoder_sum == native_sum ? "true" : "false",
+         checksum + encoder_sum);
+};
+
+int main(int argc, char** argv) {
+  srand(1);
+  
+  run("silence", 0.0, FRAMES_PER_BUFFER);
+  run("silence", 0.0, INPUT_FRAMES_PER_BUFFER);
+  run("busy-10%", 0.1, INPUT_FRAMES_PER_BUFFER);
+  run("busy-100%", 1.0, INPUT_FRAMES_PER_BUFFER);
+  
+  return 0;
+};
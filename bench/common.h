@@ -0,0 +1,65 @@
+/**
+ *  @file   common.h
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Pieces shared by the decode and loopback benchmarks: the
+ *  built-in codes, parsing of config-format entries and the
+ *  frame callback that scores what the Sampler decoded.
+ *
+ */
+
+#ifndef __rfswitch__bench_common__
+#define __rfswitch__bench_common__
+
+#include "Code.h"
+#include "Protocol.h"
+
+#include <cstdio>
+#include <cstring>
+
+// Codes (on, then off) used when none are given
+#define BENCH_DEFAULT_COUNT (2)
+
+static const char* const BENCH_DEFAULTS[BENCH_DEFAULT_COUNT][2] = {
+  {"0110100010000100,476190,1904761,1678004,702947,10000000",
+   "0110100010000000,476190,1904761,1678004,702947,10000000"},
+  {"101100111000110100101010,350000,1050000,1050000,350000,10850000",
+   "101100111000110100100110,350000,1050000,1050000,350000,10850000"}
+};
+
+// Frames decoded as the code that was sent, or as anything else
+struct Tally {
+  const char* expected;
+  long        correct;
+  long        wrong;
+};
+
+/**
+ *  Parses ``<code>,<short-hi>,<long-lo>,<long-hi>,<short-lo>,<delay>``
+ *  into ``code`` (room for MAX_CODE_BITS+1) and ``values``.
+ */
+static inline bool parse_bench_entry(const char* text, char* code, int* values) {
+  return sscanf(text, "%64[10],%d,%d,%d,%d,%d", code, &values[0], &values[1],
+                &values[2], &values[3], &values[4]) == 6;
+};
+
+/**
+ *  Sampler frame callback scoring each frame against the Tally
+ *  at ``arg``.
+ */
+static inline void tally_frame(const Frame& frame, long position, void* arg) {
+  Tally* tally = (Tally*)arg;
+  
+  // Codes are sent in the config's own line code
+  if (strcmp(frame.protocol, "legacy") != 0) {
+    return;
+  }
+  
+  if (strcmp(frame.bits, tally->expected) == 0) {
+    tally->correct++;
+  } else {
+    tally->wrong++;
+  }
+};
+
+#endif /* defined(__rfswitch__bench_common__) */
@@ -0,0 +1,224 @@
+/**
+ *  @file   decode.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Decode benchmark.  Config entries are rendered into
+ *  synthetic captures over a matrix of signal conditions
+ *  and fed through Sampler, measuring throughput, heap
+ *  allocations and how many frames come out right.
+ *
+ *  Entries can be given on the command line in config
+ *  format, ``<code>,<short-hi>,<long-lo>,<long-hi>,<short-lo>,<delay>``.
+ *
+ */
+
+#include "common.h"
+#include "Sampler.h"
+#include "Timeline.h"
+#include "Waveform.h"
+#include "record.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <new>
+#include <string>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+
+#define BENCH_TRIALS    (20)
+#define BENCH_LEAD_NS   (20000000)
+
+// Every heap allocation made by the process is counted here
+static long g_allocations = 0;
+
+void* operator new(size_t size) {
+  g_allocations++;
+  void* p = malloc(size ? size : 1);
+  if (p == NULL) {
+    throw bad_alloc();
+  }
+  return p;
+};
+
+void* operator new[](size_t size) {
+  return operator new(size);
+};
+
+void operator delete(void* p) noexcept {
+  free(p);
+};
+
+void operator delete[](void* p) noexcept {
+  free(p);
+};
+
+struct Entry {
+  string  code;
+  int     values[5];
+};
+
+struct Condition {
+  bool    adaptive;
+  bool    native;     // Fed as int16, as a 16-bit interface delivers it
+  float   amplitude;
+  float   noise;
+  float   offset;
+  int     jitter_us;
+};
+
+static double now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+};
+
+static bool parse_entry(const char* text, Entry& entry) {
+  char code[MAX_CODE_BITS+1];
+  
+  if (!parse_bench_entry(text, code, entry.values)) {
+    return false;
+  }
+  
+  entry.code = code;
+  return true;
+};
+
+static void run(const Entry& entry, double rate, const Condition& cond) {
+  Timeline        timeline;
+  vector<float>   buffer;
+  vector<int16_t> native;
+  Tally         tally   = {entry.code.c_str(), 0, 0};
+  long          samples = 0,
+                found   = 0,
+                used    = 0,
+                allocs  = 0;
+  double        elapsed = 0,
+                error   = 0;
+  
+  // One trial is enough frames for the sampler to report the code
+  // without early termination
+  timeline.addCode(entry.code.c_str(), entry.values, CODE_COUNT+1);
+  
+  for (int t=0; t < BENCH_TRIALS; t++)
+  {
+    Waveform waveform(rate);
+    waveform.setAmplitude(cond.amplitude);
+    waveform.setNoise(cond.noise);
+    waveform.setOffset(cond.offset);
+    waveform.setJitter(cond.jitter_us * 1000LL);
+    waveform.setSeed(t+1);
+    
+    buffer.clear();
+    waveform.silence(BENCH_LEAD_NS, buffer);
+    waveform.render(timeline, buffer);
+    waveform.silence(BENCH_LEAD_NS, buffer);
+    
+    native.clear();
+    if (cond.native) {
+      for (size_t i=0; i < buffer.size(); i++) {
+        native.push_back(SampleTraits<int16_t>::fromLevel(buffer[i]));
+      }
+    }
+    
+    Sampler* sampler = new Sampler(rate);
+    sampler->setVerbose(false);
+    if (!cond.adaptive) {
+      sampler->setThreshold(SIGNAL_THRESH);
+    }
+    sampler->setFrameCallback(tally_frame, &tally);
+    
+    long    before  = g_allocations;
+    double  start   = now();
+    bool    done    = false;
+    
+    // The whole trial is decoded so every frame is scored, but only
+    // the first code found counts, as in a learning session
+    for (int i=0; i < (int)buffer.size(); i += INPUT_FRAMES_PER_BUFFER) {
+      int count = (int)buffer.size() - i;
+      if (count > INPUT_FRAMES_PER_BUFFER) {
+        count = INPUT_FRAMES_PER_BUFFER;
+      }
+      
+      bool found_now = cond.native ? sampler->sample(&native[i], count)
+                                   : sampler->sample(&buffer[i], count);
+      
+      if (found_now && !done) {
+        const Sampler::Result& result = sampler->getResult();
+        
+        done = true;
+        if (entry.code == result.code) {
+          found++;
+          used += result.frames;
+          for (int k=0; k < 4; k++) {
+            error += fabs(result.timings[k] - entry.values[k]) / entry.values[k];
+          }
+        }
+      }
+    }
+    
+    elapsed += now() - start;
+    allocs  += g_allocations - before;
+    samples += (long)buffer.size();
+    
+    delete sampler;
+  }
+  
+  long frames   = tally.correct + tally.wrong;
+  long rendered = (long)BENCH_TRIALS * (CODE_COUNT+1);
+  
+  printf("{\"bench\":\"decode\",\"code\":\"%s\",\"threshold\":\"%s\",\"samples\":\"%s\",\"rate\":%.0f,\"amplitude\":%.3f,"
+         "\"noise\":%.3f,\"offset\":%.3f,\"jitter_us\":%d,\"kernel\":\"%s\","
+         "\"samples_per_s\":%.0f,\"frames_per_s\":%.0f,\"allocs_per_frame\":%.3f,"
+         "\"frame_accuracy\":%.3f,\"wrong_frames\":%ld,\"found_rate\":%.3f,\"frames_used\":%.1f,\"timing_error\":%.4f}\n",
+         entry.code.c_str(), cond.adaptive ? "adaptive" : "fixed", cond.native ? "s16" : "f32", rate, cond.amplitude, cond.noise, cond.offset, cond.jitter_us,
+         RunEncoder::getKernelName(),
+         samples / elapsed, frames / elapsed, frames ? (double)allocs / frames : (double)allocs,
+         (double)tally.correct / rendered, tally.wrong, (double)found / BENCH_TRIALS,
+         found ? (double)used / found : 0.0, found ? error / (4*found) : 0.0);
+};
+
+int main(int argc, char** argv) {
+  vector<Entry> entries;
+  
+  for (int i=1; i < argc; i++) {
+    Entry entry;
+    if (!parse_entry(argv[i], entry)) {
+      fprintf(stderr, "Invalid entry: %s\n", argv[i]);
+      return 1;
+    }
+    entries.push_back(entry);
+  }
+  
+  if (entries.empty()) {
+    for (int i=0; i < BENCH_DEFAULT_COUNT; i++) {
+      Entry entry;
+      parse_entry(BENCH_DEFAULTS[i][0], entry);
+      entries.push_back(entry);
+    }
+  }
+  
+  const double    rates[]       = {16000, SAMPLE_RATE, 192000};
+  const float     amplitudes[]  = {0.5f, 0.05f};
+  const float     noises[]      = {0.0f, 0.002f, 0.005f};
+  const float     offsets[]     = {0.0f, 0.01f};
+  const int       jitters[]     = {0, 15, 50};
+  
+  for (size_t e=0; e < entries.size(); e++)
+  for (int adaptive=0; adaptive < 2; adaptive++)
+  for (int native=0; native < 2; native++)
+  for (size_t r=0; r < sizeof(rates)/sizeof(rates[0]); r++)
+  for (size_t a=0; a < sizeof(amplitudes)/sizeof(amplitudes[0]); a++)
+  for (size_t n=0; n < sizeof(noises)/sizeof(noises[0]); n++)
+  for (size_t o=0; o < sizeof(offsets)/sizeof(offsets[0]); o++)
+  for (size_t j=0; j < sizeof(jitters)/sizeof(jitters[0]); j++)
+  {
+    Condition cond = {adaptive != 0, native != 0, amplitudes[a], noises[n], offsets[o], jitters[j]};
+    run(entries[e], rates[r], cond);
+  }
+  
+  return 0;
+};
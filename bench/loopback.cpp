@@ -0,0 +1,291 @@
+/**
+ *  @file   loopback.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Round trip of the transmit path into the receive path.
+ *  Every code in the config is compiled into the timeline
+ *  ``rfswitch s`` would play, rendered with a growing amount
+ *  of edge jitter (the transmitter missing its deadlines) and
+ *  decoded by the Sampler ``rfswitch r`` uses.  A jitter level
+ *  passes when, in every trial,
+ *
+ *    - one command gets at least ``min-frames`` frames through
+ *      (LOOPBACK_MIN_FRAMES without a hint) and no frame
+ *      decodes to other bits, and
+ *    - recording the command sent over and over learns the
+ *      same code back, with timings within
+ *      LOOPBACK_TIMING_ERROR of the config.
+ *
+ *  The largest jitter below which every level passes is the
+ *  code's jitter limit: how far off its deadlines the
+ *  transmitter can be before switching gets unreliable.
+ *
+ *  Usage: loopback [-c <config>] [-r <rate>] [-a <amplitude>]
+ *                  [-n <noise>] [-t <trials>] [-l <floor-us>]
+ *
+ *  Without a config, two built-in codes are tested.  Exits
+ *  non-zero when a code fails even without jitter, or when its
+ *  jitter limit falls below the ``-l`` floor.
+ *
+ */
+
+#include "common.h"
+#include "Sampler.h"
+#include "Timeline.h"
+#include "Waveform.h"
+#include "record.h"
+#include "switch.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <list>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+#define LOOPBACK_TRIALS       (10)
+#define LOOPBACK_LEAD_NS      (20000000)
+
+// Frames a code without a min-frames hint must get through
+#define LOOPBACK_MIN_FRAMES   (2)
+
+// Largest mean error of the relearned timings, as a fraction
+#define LOOPBACK_TIMING_ERROR (0.05)
+
+struct Options {
+  double  rate;
+  float   amplitude;
+  float   noise;
+  int     trials;
+  int     floor_us;   // Smallest acceptable jitter limit, or -1
+};
+
+// Per jitter level, summed over the trials
+struct Outcome {
+  long    latched;    // Commands that got enough frames through
+  long    relearned;  // Recordings that learned the code back
+  long    frames;     // Correct frames, over every command
+  long    wrong;      // Frames that decoded to other bits
+  double  error;      // Timing error, over every relearned code
+};
+
+/**
+ *  Feeds ``samples`` to ``sampler`` the way a capture would,
+ *  stopping once a code is found if ``stop`` is set.
+ */
+static bool decode(Sampler* sampler, vector<float>& samples, bool stop) {
+  bool found = false;
+  
+  for (int i=0; i < (int)samples.size(); i += INPUT_FRAMES_PER_BUFFER) {
+    int count = (int)samples.size() - i;
+    if (count > INPUT_FRAMES_PER_BUFFER) {
+      count = INPUT_FRAMES_PER_BUFFER;
+    }
+    
+    if (sampler->sample(&samples[i], count)) {
+      found = true;
+      if (stop) {
+        break;
+      }
+    }
+  }
+  
+  return found;
+};
+
+static void run_level(const CodeData& cd, int a, Timeline& timeline, const Options& opt,
+                      int jitter_us, Outcome& out) {
+  vector<float> buffer;
+  int           need    = cd.min_frames ? cd.min_frames : LOOPBACK_MIN_FRAMES;
+  
+  // Enough back to back commands for the recorder to settle on a code
+  int           bursts  = (CODE_COUNT+1 + timeline.getFrames()-1) / timeline.getFrames() + 1;
+  
+  memset(&out, 0, sizeof(out));
+  
+  for (int t=0; t < opt.trials; t++)
+  {
+    Waveform waveform(opt.rate);
+    waveform.setAmplitude(opt.amplitude);
+    waveform.setNoise(opt.noise);
+    waveform.setJitter(jitter_us * 1000LL);
+    waveform.setSeed(t+1);
+    
+    // One command, as a socket hears it
+    Tally tally = {cd.codes[a], 0, 0};
+    
+    buffer.clear();
+    waveform.silence(LOOPBACK_LEAD_NS, buffer);
+    waveform.render(timeline, buffer);
+    waveform.silence(LOOPBACK_LEAD_NS, buffer);
+    
+    Sampler* sampler = new Sampler(opt.rate);
+    sampler->setVerbose(false);
+    sampler->setFrameCallback(tally_frame, &tally);
+    decode(sampler, buffer, false);
+    delete sampler;
+    
+    out.frames  += tally.correct;
+    out.wrong   += tally.wrong;
+    if (tally.correct >= need && tally.wrong == 0) {
+      out.latched++;
+    }
+    
+    // The command sent over and over while ``rfswitch r`` listens
+    buffer.clear();
+    waveform.silence(LOOPBACK_LEAD_NS, buffer);
+    for (int b=0; b < bursts; b++) {
+      waveform.render(timeline, buffer);
+    }
+    waveform.silence(LOOPBACK_LEAD_NS, buffer);
+    
+    sampler = new Sampler(opt.rate);
+    sampler->setVerbose(false);
+    
+    if (decode(sampler, buffer, true)) {
+      const Sampler::Result& result = sampler->getResult();
+      double error = 0;
+      
+      for (int k=0; k < 4; k++) {
+        error += fabs(result.timings[k] - cd.values[a][k]) / cd.values[a][k];
+      }
+      error /= 4;
+      
+      if (strcmp(result.code, cd.codes[a]) == 0 && error <= LOOPBACK_TIMING_ERROR) {
+        out.relearned++;
+        out.error += error;
+      }
+    }
+    
+    delete sampler;
+  }
+};
+
+/**
+ *  Finds the jitter limit of action ``a`` of ``cd``, returning
+ *  false if it misses the floor in ``opt`` (or has none at all).
+ */
+static bool run(const CodeData& cd, int a, const Options& opt) {
+  const int jitters[] = {0, 5, 10, 20, 35, 50, 75, 100, 150, 200, 300, 500};
+  int       limit     = -1;
+  bool      passing   = true;
+  Timeline  timeline;
+  
+  compile_code(cd, a, timeline);
+  
+  for (size_t j=0; j < sizeof(jitters)/sizeof(jitters[0]); j++)
+  {
+    Outcome out;
+    
+    run_level(cd, a, timeline, opt, jitters[j], out);
+    
+    bool pass = (out.latched == opt.trials && out.relearned == opt.trials);
+    if (pass && passing) {
+      limit = jitters[j];
+    } else {
+      passing = false;
+    }
+    
+    printf("{\"bench\":\"loopback\",\"id\":%d,\"action\":\"%s\",\"rate\":%.0f,\"amplitude\":%.3f,"
+           "\"noise\":%.3f,\"jitter_us\":%d,\"frames\":%.1f,\"wrong_frames\":%ld,"
+           "\"latched\":%.3f,\"relearned\":%.3f,\"timing_error\":%.4f,\"pass\":%s}\n",
+           cd.id, a ? "off" : "on", opt.rate, opt.amplitude, opt.noise, jitters[j],
+           (double)out.frames / opt.trials, out.wrong,
+           (double)out.latched / opt.trials, (double)out.relearned / opt.trials,
+           out.relearned ? out.error / out.relearned : 0.0, pass ? "true" : "false");
+  }
+  
+  printf("{\"bench\":\"loopback\",\"id\":%d,\"action\":\"%s\",\"code\":\"%s\",\"repeats\":%d,"
+         "\"min_frames\":%d,\"airtime_ms\":%.1f,\"jitter_limit_us\":",
+         cd.id, a ? "off" : "on", cd.codes[a], cd.repeats,
+         cd.min_frames ? cd.min_frames : LOOPBACK_MIN_FRAMES, timeline.getDuration()/1e6);
+  if (limit < 0) {
+    printf("null}\n");
+  } else {
+    printf("%d}\n", limit);
+  }
+  fflush(stdout);
+  
+  return limit >= 0 && limit >= opt.floor_us;
+};
+
+int main(int argc, char** argv) {
+  Options         opt     = {SAMPLE_RATE, 0.5f, 0.002f, LOOPBACK_TRIALS, -1};
+  const char*     config  = NULL;
+  list<CodeData>  codes;
+  int             failed  = 0;
+  int             c;
+  
+  while ((c = getopt(argc, argv, "c:r:a:n:t:l:")) != -1)
+  {
+    switch (c)
+    {
+      case 'c':
+        config = optarg;
+        break;
+      case 'r':
+        opt.rate = atof(optarg);
+        break;
+      case 'a':
+        opt.amplitude = (float)atof(optarg);
+        break;
+      case 'n':
+        opt.noise = (float)atof(optarg);
+        break;
+      case 't':
+        opt.trials = atoi(optarg);
+        break;
+      case 'l':
+        opt.floor_us = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-c <config>] [-r <rate>] [-a <amplitude>] "
+                        "[-n <noise>] [-t <trials>] [-l <floor-us>]\n", argv[0]);
+        return 1;
+    }
+  }
+  
+  if (opt.rate < MIN_RATE || opt.trials < 1) {
+    fprintf(stderr, "Invalid rate or trial count\n");
+    return 1;
+  }
+  
+  if (config != NULL) {
+    if (load_codes(config, codes) < 0) {
+      fprintf(stderr, "Invalid config: %s\n", config);
+      return 1;
+    }
+  }
+  
+  else
+  {
+    for (int i=0; i < BENCH_DEFAULT_COUNT; i++) {
+      CodeData cd;
+      cd.id         = i+1;
+      cd.repeats    = REPEAT_COUNT;
+      cd.min_frames = 0;
+      for (int a=0; a < 2; a++) {
+        parse_bench_entry(BENCH_DEFAULTS[i][a], cd.codes[a], cd.values[a]);
+      }
+      codes.push_back(cd);
+    }
+  }
+  
+  for (list<CodeData>::iterator it = codes.begin(); it != codes.end(); it++) {
+    for (int a=0; a < 2; a++) {
+      if (!run(*it, a, opt)) {
+        failed++;
+      }
+    }
+  }
+  
+  if (failed) {
+    fprintf(stderr, "%d code(s) failed\n", failed);
+    return 1;
+  }
+  
+  return 0;
+};
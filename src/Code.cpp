@@ -7,146 +7,216 @@
 #include "Code.h"
 #include "record.h"
 
+#include <climits>
+
 using namespace std;
 
-Code::Code()
-: m_last_value(-1)
-{};
+Code::Code(int min_bit)
+: m_min_bit(min_bit)
+{
+  for (int i=0; i < 2; i++) {
+    m_split[i]    = 0;
+    m_seed[i][0]  = 0;
+    m_seed[i][1]  = 0;
+  }
+  
+  this->reset();
+};
 
-int Code::addValue(int value) {
-  if (value == 0 && m_last_value == -1) {
-    return 0;
+/**
+ *  Adds the next run of the frame, which must be at the other
+ *  level from the one before.  Returns false once the frame has
+ *  been rejected.
+ */
+bool Code::addRun(int state, int count) {
+  if (m_rejected) {
+    return false;
   }
   
-  Bit* bit = NULL;
+  if (state == 0 && m_last_value == -1) {
+    // Frames start with a high run
+    return true;
+  }
   
-  if (value != m_last_value) {
-    bit = new Bit;
-    
-    bit->state = 0;
-    bit->count = 0;
-    
-    m_bits.push_back(bit);
-  } else {
-    bit = m_bits.back();
+  if (count < m_min_bit || state == m_last_value || m_size >= MAX_CODE_RUNS-1) {
+    // Invalid code - bit is too short, or too many bits
+    m_rejected  = true;
+    m_reason    = (m_size >= MAX_CODE_RUNS-1) ? REJECT_TOO_LONG : REJECT_SHORT_RUN;
+    return false;
   }
   
-  if (bit != NULL) {
-    bit->state = value;
-    bit->count++;
+  m_bits[m_size].state = state;
+  m_bits[m_size].count = count;
+  m_size++;
+  
+  m_last_value     = state;
+  m_sum[state]    += count;
+  m_count[state]++;
+  
+  if (m_split[state] > 0) {
+    if (!this->fits(state, count)) {
+      // Nothing like any run of the last frame; if another remote
+      // has started sending, learn it afresh from its next frame
+      m_rejected  = true;
+      m_reason    = REJECT_TIMING;
+      m_split[0]  = 0;
+      m_split[1]  = 0;
+      return false;
+    }
+    this->classify(state, count);
   }
   
-  m_last_value = value;
+  return true;
+};
+
+/**
+ *  Returns true unless a run is further than CODE_RUN_TOLERANCE
+ *  below the mean short run, or above the mean long run, at
+ *  its level in the seeding frame.  Anything in between is left
+ *  to the split, and a class that frame didn't have can't rule
+ *  anything out.
+ */
+bool Code::fits(int state, int count)
+{
+  double longest   = m_seed[state][0] * (1 + CODE_RUN_TOLERANCE);
+  double shortest  = m_seed[state][1] * (1 - CODE_RUN_TOLERANCE);
   
-  return (int)m_bits.size();
+  if (m_seed[state][0] > 0 && count > longest) {
+    return false;
+  }
+  
+  return m_seed[state][1] <= 0 || count >= shortest;
 };
 
+/**
+ *  Classifies a run as long or short, completing a bit at the
+ *  end of each low run.  A '1' is a long high followed by a
+ *  short low.
+ */
+void Code::classify(int state, int count)
+{
+  bool is_long = count > m_split[state];
+  
+  if (is_long) {
+    m_long_sum[state] += count;
+    m_long_count[state]++;
+    if (count < m_min_long[state]) {
+      m_min_long[state] = count;
+    }
+  } else {
+    m_short_sum[state] += count;
+    m_short_count[state]++;
+    if (count > m_max_short[state]) {
+      m_max_short[state] = count;
+    }
+  }
+  
+  if (state == 1) {
+    m_hi_long = is_long;
+  } else {
+    m_code[m_code_length++] = (m_hi_long && !is_long) ? '1' : '0';
+  }
+};
+
+/**
+ *  Finishes the frame once its trailing gap has been seen.
+ *  Returns true if it is a code.
+ */
 bool Code::validate()
 {
-  double  ave[2]          = {0, 0};
-  int     count[2]        = {1, 1};
-  int     long_count[2]   = {1, 1};
-  int     short_count[2]  = {1, 1};
-  int     i               = 1;
-  int     size            = (int)m_bits.size();
-  
-  if (size < MIN_CODE_LENGTH) {
+  // The final bit is a lone high run; its low is the gap
+  if (m_rejected) {
+    return false;
+  }
+  
+  if (m_size < MIN_CODE_LENGTH-1 || m_last_value != 1) {
     // Invalid code - not enough bits
+    m_rejected  = true;
+    m_reason    = REJECT_FEW_RUNS;
     return false;
   }
   
-  for (std::list<Code::Bit*>::iterator it=m_bits.begin(); it != m_bits.end(); ++it) {
-    if (i < size) {
-      
-      if ((*it)->count < MIN_BIT_LENGTH) {
-        // Invalid code - bit is too short
-        return false;
-      }
-      
-      ave[(*it)->state] += ((*it)->count-ave[(*it)->state])/count[(*it)->state];
-      count[(*it)->state]++;
+  double  mean[2] = {(double)m_sum[0] / m_count[0], (double)m_sum[1] / m_count[1]};
+  bool    agrees  = (m_split[0] > 0 && m_split[1] > 0);
+  
+  for (int i=0; i < 2; i++) {
+    if (m_max_short[i] > mean[i] || m_min_long[i] <= mean[i]) {
+      agrees = false;
     }
-    
-    i++;
   }
   
-  SIGNAL_BIT bit;   // Current bit
-  SIGNAL_BIT pbit;  // Previous bit
-  
-  i = 0;
-  for (std::list<Code::Bit*>::iterator it=m_bits.begin(); it != m_bits.end(); ++it) {
-    int state = (*it)->state,
-        count = (*it)->count;
+  if (!agrees) {
+    // Decode the kept runs against this frame's own means
+    this->restart();
+    m_split[0] = mean[0];
+    m_split[1] = mean[1];
     
-    if (i != (size-1)) {      
-      if (count > ave[state]) {
-        m_long_ave[state] += (count-m_long_ave[state])/(long_count[state]);
-        if (state == 0) {
-          bit = CODE_LO_LONG;
-        } else {
-          bit = CODE_HI_LONG;
-        }
-      } else {
-        m_short_ave[state] += (count-m_short_ave[state])/(short_count[state]);
-        if (state == 0) {
-          bit = CODE_LO_SHORT;
-        } else {
-          bit = CODE_HI_SHORT;
-        }
-      }
-      
-      if (i%2 == 1) {
-        if ((bit + pbit) == 5) {
-          m_code += "1";
-        } else {
-          m_code += "0";
-        }
-      }
+    for (int i=0; i < m_size; i++) {
+      this->classify(m_bits[i].state, m_bits[i].count);
     }
-    
-    pbit = bit;
-    i++;
   }
   
-  if (pbit == CODE_HI_SHORT) {
-    m_code += "0";
-  } else if (pbit == CODE_HI_LONG) {
-    m_code += "1";
+  m_code[m_code_length++] = m_hi_long ? '1' : '0';
+  m_code[m_code_length]   = 0;
+  
+  // The next frame is classified as it arrives
+  for (int i=0; i < 2; i++) {
+    m_split[i]    = mean[i];
+    m_seed[i][0]  = m_long_count[i]  ? (double)m_long_sum[i] / m_long_count[i]   : 0;
+    m_seed[i][1]  = m_short_count[i] ? (double)m_short_sum[i] / m_short_count[i] : 0;
   }
   
   return true;
 };
 
-void Code::reset()
+void Code::restart()
 {
-  // Reset the code string
-  m_code = "";
+  m_code[0]     = 0;
+  m_code_length = 0;
+  m_hi_long     = false;
   
-  // Delete all saved Code instances
-  for (list<Code::Bit*>::iterator it=m_bits.begin(); it != m_bits.end(); ++it) {
-    delete (*it);
-    m_bits.erase(it);
+  for (int i=0; i < 2; i++) {
+    m_long_sum[i]     = 0;
+    m_long_count[i]   = 0;
+    m_short_sum[i]    = 0;
+    m_short_count[i]  = 0;
+    m_min_long[i]     = INT_MAX;
+    m_max_short[i]    = 0;
   }
+};
+
+void Code::reset()
+{
+  // Forget the buffered runs; the storage is reused
+  m_size        = 0;
+  m_rejected    = false;
+  m_reason      = REJECT_COUNT;
+  m_last_value  = -1;
   
-  // Reset averages
   for (int i=0; i < 2; i++) {
-    m_long_ave[i]   = 0;
-    m_short_ave[i]  = 0;
+    m_sum[i]    = 0;
+    m_count[i]  = 0;
   }
   
+  this->restart();
 };
 
-string Code::getCodeString() {
+const char* Code::getCodeString() {
   return m_code;
 };
 
+/**
+ *  Returns the mean lo-long, hi-long, lo-short or hi-short run
+ *  (``i`` from 0 to 3) of the frame, in samples.
+ */
 int Code::getLength(int i)
 {
-  if (i < 4) {
-    if (i < 2) {
-      return m_long_ave[i];
-    }
-    return m_short_ave[i-2];
+  int state = i % 2;
+  
+  if (i < 2) {
+    return m_long_count[state] ? (int)(m_long_sum[state] / m_long_count[state]) : 0;
+  } else if (i < 4) {
+    return m_short_count[state] ? (int)(m_short_sum[state] / m_short_count[state]) : 0;
   }
   return 0;
 };
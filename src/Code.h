@@ -32,16 +32,49 @@
  *    lo-long   5
  *    lo-short  3
  *
+ *  Each run is long or short relative to the mean length of
+ *  runs at its level.  Once one frame has been decoded, its
+ *  means are used to classify the runs of the next frame as
+ *  they arrive, so bits are known as soon as each pulse pair
+ *  ends.  A frame is rejected at the first run that is too
+ *  short, or that is more than CODE_RUN_TOLERANCE shorter than
+ *  the short runs (or longer than the long runs) of its level
+ *  in the last frame; the frame after that is then decoded
+ *  without a seed, in case a different remote has started
+ *  sending.  The runs are
+ *  still kept, and a frame whose own means would split them
+ *  differently is decoded again from those, as the first
+ *  frame is.
+ *
  */
 
 #ifndef __rfswitch__Code__
 #define __rfswitch__Code__
 
-#include <list>
 #include <string>
 
 using namespace std;
 
+// Codes are stored in fixed buffers so that decoding never
+// has to allocate; longer frames are rejected
+#define MAX_CODE_BITS   (64)
+#define MAX_CODE_RUNS   (2*MAX_CODE_BITS)
+
+// How far (as a fraction) a run may fall short of the mean short
+// run, or exceed the mean long run, of the frame before it and
+// still belong to a code
+#define CODE_RUN_TOLERANCE  (0.5)
+
+// Why a frame was thrown away, for the decoder statistics
+enum REJECT {
+  REJECT_SHORT_RUN,   // A run shorter than MIN_BIT_TIME
+  REJECT_FEW_RUNS,    // Fewer than MIN_CODE_LENGTH runs
+  REJECT_TOO_LONG,    // More bits than a code can hold
+  REJECT_TIMING,      // A pulse pair that fits no bit
+  REJECT_SYMBOL,      // Bits that form no valid symbol
+  REJECT_COUNT
+};
+
 enum SIGNAL_BIT {
   CODE_HI_LONG  = 1,
   CODE_HI_SHORT = 5,
@@ -51,13 +84,14 @@ enum SIGNAL_BIT {
 
 class Code {
   public:
-    Code();
+    Code(int min_bit);
   
-    int         addValue(int value);
+    bool        addRun(int state, int count);
     bool        validate();
     void        reset();
-    inline int  getLength() { return (int)m_bits.size(); };
-    string      getCodeString();
+    inline int  getLength() { return m_size; };
+    inline int  getReason() { return m_reason; };
+    const char* getCodeString();
     int         getLength(int i);
   
     struct Bit {
@@ -65,11 +99,34 @@ class Code {
       int state;
     };
   private:
+    bool        fits(int state, int count);
+    void        classify(int state, int count);
+    void        restart();
+    
+    int         m_min_bit;        // Shortest run (in samples) allowed
     int         m_last_value;
-    list<Bit*>  m_bits;
-    string      m_code;
-    int         m_long_ave[2];
-    int         m_short_ave[2];
+    Bit         m_bits[MAX_CODE_RUNS];
+    int         m_size;
+    bool        m_rejected;
+    int         m_reason;         // A REJECT, once rejected
+    char        m_code[MAX_CODE_BITS+1];
+    int         m_code_length;
+    bool        m_hi_long;        // Class of the latest high run
+    
+    // Per level: the split learnt from earlier frames (0 if none),
+    // the long and short means it came with, and this frame's totals
+    double      m_split[2];
+    double      m_seed[2][2];
+    long        m_sum[2];
+    int         m_count[2];
+    
+    // Per level, for the runs classified so far
+    long        m_long_sum[2];
+    int         m_long_count[2];
+    long        m_short_sum[2];
+    int         m_short_count[2];
+    int         m_min_long[2];
+    int         m_max_short[2];
 };
 
 #endif /* defined(__rfswitch__Code__) */
@@ -0,0 +1,411 @@
+/**
+ *  @file   CodeCache.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "CodeCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+static inline uint32_t hash_id(int32_t id)
+{
+  // Knuth's multiplicative hash
+  return (uint32_t)id * 2654435761u;
+};
+
+static int64_t get_mtime(const struct stat& st)
+{
+  return st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec;
+};
+
+/**
+ *  FNV-1a hash of the whole file, or 0 if it can't be read.
+ */
+static uint64_t hash_file(const string& path)
+{
+  uint64_t      hash  = 14695981039346656037ULL;
+  unsigned char buffer[4096];
+  size_t        n;
+  FILE*         fh    = fopen(path.c_str(), "rb");
+
+  if (fh == NULL) {
+    return 0;
+  }
+
+  while ((n = fread(buffer, 1, sizeof(buffer), fh)) > 0) {
+    for (size_t i=0; i < n; i++) {
+      hash = (hash ^ buffer[i]) * 1099511628211ULL;
+    }
+  }
+
+  fclose(fh);
+  return hash;
+};
+
+string CodeCache::getPath(const string& config)
+{
+  return config + ".cache";
+};
+
+CodeCache::CodeCache()
+: m_map(MAP_FAILED), m_size(0), m_header(NULL)
+{};
+
+CodeCache::~CodeCache()
+{
+  this->close();
+};
+
+/**
+ *  Maps the cache at ``path``.  Returns false if it is missing,
+ *  corrupt, or was built from something other than the current
+ *  contents of ``config``.
+ */
+bool CodeCache::open(const string& path, const string& config)
+{
+  struct stat st, src;
+
+  this->close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  if (fstat(fd, &st) < 0 || stat(config.c_str(), &src) < 0 ||
+      st.st_size < (off_t)sizeof(Header)) {
+    ::close(fd);
+    return false;
+  }
+
+  m_size  = st.st_size;
+  m_map   = mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (m_map == MAP_FAILED) {
+    return false;
+  }
+
+  const Header* h = (const Header*)m_map;
+
+  bool valid = (memcmp(h->magic, CACHE_MAGIC, 4) == 0 &&
+                h->version == CACHE_VERSION &&
+                h->bucket_count > 0 && (h->bucket_count & (h->bucket_count-1)) == 0 &&
+                h->codes_offset   + (uint64_t)h->code_count*sizeof(Code)       <= m_size &&
+                h->buckets_offset + (uint64_t)h->bucket_count*sizeof(int32_t)  <= m_size &&
+                h->scenes_offset  + (uint64_t)h->scene_count*sizeof(Scene)     <= m_size &&
+                h->members_offset + (uint64_t)h->member_count*sizeof(Member)   <= m_size);
+
+  // A touched but otherwise unchanged config is still fine; only
+  // rehash the text when the cheap checks disagree
+  if (valid && (uint64_t)src.st_size != h->source_size) {
+    valid = false;
+  } else if (valid && get_mtime(src) != h->source_mtime) {
+    valid = (hash_file(config) == h->source_hash);
+  }
+
+  if (!valid) {
+    this->close();
+    return false;
+  }
+
+  m_header = h;
+  return true;
+};
+
+void CodeCache::close()
+{
+  if (m_map != MAP_FAILED) {
+    munmap(m_map, m_size);
+    m_map = MAP_FAILED;
+  }
+  m_header = NULL;
+};
+
+const CodeCache::Code* CodeCache::find(int id)
+{
+  const char*     base    = (const char*)m_map;
+  const Code*     codes   = (const Code*)(base + m_header->codes_offset);
+  const int32_t*  buckets = (const int32_t*)(base + m_header->buckets_offset);
+  uint32_t        mask    = m_header->bucket_count - 1;
+
+  for (uint32_t i = hash_id(id) & mask, n = 0; n <= mask; i = (i+1) & mask, n++) {
+    int32_t index = buckets[i];
+
+    if (index < 0 || (uint32_t)index >= m_header->code_count) {
+      return NULL;
+    }
+    if (codes[index].id == id) {
+      return &codes[index];
+    }
+  }
+
+  return NULL;
+};
+
+/**
+ *  Fills ``cd`` from ``code``.  Returns false if the lengths
+ *  don't fit a CodeData; the cache is only checked against the
+ *  config, so its own contents can't be trusted blindly.
+ */
+bool CodeCache::unpack(const Code& code, CodeData& cd)
+{
+  if (code.length[0] > MAX_CODE_BITS || code.length[1] > MAX_CODE_BITS) {
+    return false;
+  }
+
+  cd.id         = code.id;
+  cd.repeats    = code.repeats;
+  cd.min_frames = code.min_frames;
+
+  for (int a = 0; a < 2; a++) {
+    int length = code.length[a];
+
+    for (int i = 0; i < length; i++) {
+      cd.codes[a][i] = ((code.bits[a] >> i) & 1) ? '1' : '0';
+    }
+    cd.codes[a][length] = 0;
+
+    memcpy(cd.values[a], code.values[a], sizeof(cd.values[a]));
+  }
+
+  return true;
+};
+
+bool CodeCache::unpack(const Scene& scene, SceneData& sd)
+{
+  const Member* members = (const Member*)((const char*)m_map + m_header->members_offset);
+
+  if ((uint64_t)scene.first_member + scene.member_count > m_header->member_count) {
+    return false;
+  }
+
+  sd.name.assign(scene.name, strnlen(scene.name, CACHE_NAME_SIZE));
+  sd.members.clear();
+
+  for (uint32_t m = 0; m < scene.member_count; m++) {
+    SceneData::Member member;
+    member.id     = members[scene.first_member + m].id;
+    member.action = members[scene.first_member + m].action;
+    sd.members.push_back(member);
+  }
+
+  return true;
+};
+
+bool CodeCache::getCode(int id, CodeData& cd)
+{
+  const Code* code = (m_header != NULL) ? this->find(id) : NULL;
+
+  if (code == NULL) {
+    return false;
+  }
+
+  return unpack(*code, cd);
+};
+
+bool CodeCache::getScene(const string& name, SceneData& scene)
+{
+  if (m_header == NULL) {
+    return false;
+  }
+
+  const Scene* scenes = (const Scene*)((const char*)m_map + m_header->scenes_offset);
+
+  for (uint32_t s = 0; s < m_header->scene_count; s++) {
+    if (strncmp(scenes[s].name, name.c_str(), CACHE_NAME_SIZE) == 0) {
+      return this->unpack(scenes[s], scene);
+    }
+  }
+
+  return false;
+};
+
+/**
+ *  Appends every code (and scene) in the cache, for callers
+ *  that keep the whole config resident.  Returns false if no
+ *  cache is open or it is inconsistent.
+ */
+bool CodeCache::load(list<CodeData>& codes, list<SceneData>* scenes)
+{
+  if (m_header == NULL) {
+    return false;
+  }
+
+  const char* base  = (const char*)m_map;
+  const Code* table = (const Code*)(base + m_header->codes_offset);
+
+  for (uint32_t i = 0; i < m_header->code_count; i++) {
+    CodeData cd;
+    if (!unpack(table[i], cd)) {
+      return false;
+    }
+    codes.push_back(cd);
+  }
+
+  if (scenes != NULL) {
+    const Scene* scene_table = (const Scene*)(base + m_header->scenes_offset);
+
+    for (uint32_t s = 0; s < m_header->scene_count; s++) {
+      SceneData scene;
+      if (!this->unpack(scene_table[s], scene)) {
+        return false;
+      }
+      scenes->push_back(scene);
+    }
+  }
+
+  return true;
+};
+
+/**
+ *  Parses and validates ``config`` and writes the compiled
+ *  cache to ``path``.
+ */
+RF_ERROR CodeCache::compile(const string& config, const string& path)
+{
+  list<CodeData>  parsed;
+  list<SceneData> scenes;
+  struct stat     src;
+
+  if (stat(config.c_str(), &src) < 0 || load_codes(config.c_str(), parsed, &scenes) < 0) {
+    return RFE_INVALID_CONFIG;
+  }
+
+  // Later entries for the same id win, just like the text lookup
+  map<int, CodeData*> unique;
+  for (list<CodeData>::iterator it = parsed.begin(); it != parsed.end(); it++) {
+    unique[(*it).id] = &(*it);
+  }
+
+  vector<Code> codes;
+  for (map<int, CodeData*>::iterator it = unique.begin(); it != unique.end(); it++)
+  {
+    Code code;
+    memset(&code, 0, sizeof(code));
+    code.id         = it->first;
+    code.repeats    = it->second->repeats;
+    code.min_frames = it->second->min_frames;
+
+    for (int a = 0; a < 2; a++) {
+      const char* bits = it->second->codes[a];
+      int         len  = (int)strlen(bits);
+
+      if (len > MAX_CODE_BITS) {
+        printf("Code %d is too long to compile\n", code.id);
+        return RFE_INVALID_CONFIG;
+      }
+
+      code.length[a] = (uint8_t)len;
+      for (int i = 0; i < len; i++) {
+        if (bits[i] == '1') {
+          code.bits[a] |= (1ULL << i);
+        }
+      }
+      memcpy(code.values[a], it->second->values[a], sizeof(code.values[a]));
+    }
+
+    codes.push_back(code);
+  }
+
+  // Keep the table at most half full so probes stay short
+  uint32_t buckets = 1;
+  while (buckets < 2*codes.size()) {
+    buckets <<= 1;
+  }
+
+  vector<int32_t> table(buckets, -1);
+  for (size_t i = 0; i < codes.size(); i++) {
+    uint32_t b = hash_id(codes[i].id) & (buckets-1);
+    while (table[b] >= 0) {
+      b = (b+1) & (buckets-1);
+    }
+    table[b] = (int32_t)i;
+  }
+
+  vector<Scene>   scene_table;
+  vector<Member>  members;
+  for (list<SceneData>::iterator it = scenes.begin(); it != scenes.end(); it++)
+  {
+    Scene scene;
+    memset(&scene, 0, sizeof(scene));
+
+    if ((*it).name.size() >= CACHE_NAME_SIZE) {
+      printf("Scene name %s is too long\n", (*it).name.c_str());
+      return RFE_INVALID_CONFIG;
+    }
+    strcpy(scene.name, (*it).name.c_str());
+    scene.first_member = (uint32_t)members.size();
+    scene.member_count = (uint32_t)(*it).members.size();
+
+    for (size_t m = 0; m < (*it).members.size(); m++) {
+      if (unique.find((*it).members[m].id) == unique.end()) {
+        printf("Scene %s refers to unknown id %d\n", scene.name, (*it).members[m].id);
+        return RFE_INVALID_CONFIG;
+      }
+
+      Member member;
+      member.id     = (*it).members[m].id;
+      member.action = (*it).members[m].action;
+      members.push_back(member);
+    }
+
+    scene_table.push_back(scene);
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_MAGIC, 4);
+  header.version        = CACHE_VERSION;
+  header.source_mtime   = get_mtime(src);
+  header.source_size    = src.st_size;
+  header.source_hash    = hash_file(config);
+  header.code_count     = (uint32_t)codes.size();
+  header.bucket_count   = buckets;
+  header.scene_count    = (uint32_t)scene_table.size();
+  header.member_count   = (uint32_t)members.size();
+  header.codes_offset   = sizeof(Header);
+  header.buckets_offset = header.codes_offset   + header.code_count*sizeof(Code);
+  header.scenes_offset  = header.buckets_offset + header.bucket_count*sizeof(int32_t);
+  header.members_offset = header.scenes_offset  + header.scene_count*sizeof(Scene);
+
+  // Write to a temporary file and rename, so readers never see
+  // a half-written cache
+  string  tmp = path + ".tmp";
+  FILE*   fh  = fopen(tmp.c_str(), "wb");
+
+  if (fh == NULL) {
+    return RFE_CACHE_WRITE;
+  }
+
+  bool ok = (fwrite(&header, sizeof(header), 1, fh) == 1);
+  if (!codes.empty()) {
+    ok = ok && fwrite(&codes[0], sizeof(Code), codes.size(), fh) == codes.size();
+  }
+  ok = ok && fwrite(&table[0], sizeof(int32_t), table.size(), fh) == table.size();
+  if (!scene_table.empty()) {
+    ok = ok && fwrite(&scene_table[0], sizeof(Scene), scene_table.size(), fh) == scene_table.size();
+    ok = ok && fwrite(&members[0], sizeof(Member), members.size(), fh) == members.size();
+  }
+  ok = (fclose(fh) == 0) && ok;
+
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return RFE_CACHE_WRITE;
+  }
+
+  printf("Compiled %d codes and %d scenes into %s\n",
+         (int)codes.size(), (int)scene_table.size(), path.c_str());
+
+  return RFE_NO_ERROR;
+};
@@ -0,0 +1,92 @@
+/**
+ *  @file   CodeCache.h
+ *  @class  CodeCache
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  A compiled, memory-mapped copy of the config file.  Codes
+ *  are bit-packed and indexed by a hash of their id, so the
+ *  switch path can find a code in O(1) without parsing any
+ *  text.  The cache records the size, mtime and hash of the
+ *  text it was built from and is ignored once that changes.
+ *
+ *  Built with ``rfswitch compile``.
+ *
+ */
+
+#ifndef __rfswitch__CodeCache__
+#define __rfswitch__CodeCache__
+
+#include "error.h"
+#include "switch.h"
+
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+#define CACHE_MAGIC       "RFSC"
+#define CACHE_VERSION     (2)
+#define CACHE_NAME_SIZE   (32)
+
+class CodeCache {
+  public:
+    struct Header {
+      char      magic[4];
+      uint32_t  version;
+      int64_t   source_mtime;       // ns
+      uint64_t  source_size;
+      uint64_t  source_hash;        // FNV-1a
+      uint32_t  code_count;
+      uint32_t  bucket_count;       // Power of two
+      uint32_t  scene_count;
+      uint32_t  member_count;
+      uint32_t  codes_offset;
+      uint32_t  buckets_offset;
+      uint32_t  scenes_offset;
+      uint32_t  members_offset;
+    };
+
+    struct Code {
+      int32_t   id;
+      uint8_t   length[2];          // In bits
+      uint8_t   pad[2];
+      uint64_t  bits[2];            // Bit i of the code is bit i here
+      int32_t   values[2][5];       // Gap already applied
+      int32_t   repeats;
+      int32_t   min_frames;
+    };
+
+    struct Scene {
+      char      name[CACHE_NAME_SIZE];
+      uint32_t  first_member;
+      uint32_t  member_count;
+    };
+
+    struct Member {
+      int32_t   id;
+      int32_t   action;
+    };
+
+    CodeCache();
+    ~CodeCache();
+
+    bool            open(const string& path, const string& config);
+    void            close();
+    bool            getCode(int id, CodeData& cd);
+    bool            getScene(const string& name, SceneData& scene);
+    bool            load(list<CodeData>& codes, list<SceneData>* scenes = NULL);
+
+    static RF_ERROR compile(const string& config, const string& path);
+    static string   getPath(const string& config);
+
+  private:
+    const Code*     find(int id);
+    static bool     unpack(const Code& code, CodeData& cd);
+    bool            unpack(const Scene& scene, SceneData& sd);
+
+    void*           m_map;
+    size_t          m_size;
+    const Header*   m_header;
+};
+
+#endif /* defined(__rfswitch__CodeCache__) */
@@ -0,0 +1,118 @@
+/**
+ *  @file   Decimator.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "Decimator.h"
+
+/**
+ *  The mean of ``count`` samples that add up to ``sum``.
+ */
+template <typename T>
+static inline T average(typename SampleTraits<T>::Sum sum, int count)
+{
+  return (T)(sum / count);
+};
+
+template <>
+inline float average<float>(float sum, int count)
+{
+  return sum * (1.0f / count);
+};
+
+/**
+ *  Averages every whole block of ``N`` samples in ``in``.  With
+ *  ``N`` known at compile time the inner loop is unrolled.
+ */
+template <int N, typename T>
+static int decimate(const T* in, int blocks, T* out)
+{
+  for (int b=0; b < blocks; b++) {
+    typename SampleTraits<T>::Sum sum = 0;
+    for (int k=0; k < N; k++) {
+      sum += in[b*N + k];
+    }
+    out[b] = average<T>(sum, N);
+  }
+  return blocks;
+};
+
+template <typename T>
+static int decimate(const T* in, int blocks, int factor, T* out)
+{
+  switch (factor) {
+    case 2: return decimate<2>(in, blocks, out);
+    case 3: return decimate<3>(in, blocks, out);
+    case 4: return decimate<4>(in, blocks, out);
+  }
+
+  for (int b=0; b < blocks; b++) {
+    typename SampleTraits<T>::Sum sum = 0;
+    for (int k=0; k < factor; k++) {
+      sum += in[b*factor + k];
+    }
+    out[b] = average<T>(sum, factor);
+  }
+  return blocks;
+};
+
+Decimator::Decimator(int factor)
+: m_factor(factor < 1 ? 1 : factor)
+{
+  this->reset();
+};
+
+/**
+ *  The largest factor that keeps ``rate`` at or above
+ *  ``decode_rate``, or 1 if it is below already.
+ */
+int Decimator::getFactor(double rate, double decode_rate)
+{
+  int factor = (int)(rate / decode_rate + 1e-6);
+  return factor < 1 ? 1 : factor;
+};
+
+void Decimator::reset()
+{
+  m_sum     = 0;
+  m_filled  = 0;
+};
+
+/**
+ *  Decimates ``length`` samples into ``out`` and returns how
+ *  many were written, which is at most
+ *  (length + factor - 1) / factor.
+ */
+template <typename T>
+int Decimator::process(const T* in, int length, T* out)
+{
+  int i     = 0;
+  int count = 0;
+
+  // Finish the block the last buffer left open
+  if (m_filled > 0) {
+    for (; i < length && m_filled < m_factor; i++, m_filled++) {
+      m_sum += in[i];
+    }
+    if (m_filled < m_factor) {
+      return 0;
+    }
+    out[count++] = average<T>((typename SampleTraits<T>::Sum)m_sum, m_factor);
+    this->reset();
+  }
+
+  int blocks = (length - i) / m_factor;
+  count += decimate(in + i, blocks, m_factor, out + count);
+  i     += blocks * m_factor;
+
+  for (; i < length; i++, m_filled++) {
+    m_sum += in[i];
+  }
+
+  return count;
+};
+
+template int Decimator::process<int16_t>(const int16_t* in, int length, int16_t* out);
+template int Decimator::process<int32_t>(const int32_t* in, int length, int32_t* out);
+template int Decimator::process<float>(const float* in, int length, float* out);
@@ -0,0 +1,43 @@
+/**
+ *  @file   Decimator.h
+ *  @class  Decimator
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Reduces the sample rate by a whole factor, replacing each
+ *  block of ``factor`` samples with their mean.  A boxcar is
+ *  a poor filter in general, but the receivers put out an
+ *  on/off envelope whose pulses are hundreds of microseconds
+ *  long, so it removes high frequency noise well enough and
+ *  costs one add per input sample.
+ *
+ *  Samples keep their type; integer blocks are summed in a
+ *  wider integer and divided, so int16 input stays int16.  A
+ *  block left unfinished at the end of a buffer is completed
+ *  by the next call to ``process``.
+ *
+ */
+
+#ifndef __rfswitch__Decimator__
+#define __rfswitch__Decimator__
+
+#include "SampleType.h"
+
+class Decimator {
+  public:
+    Decimator(int factor);
+
+    template <typename T>
+    int         process(const T* in, int length, T* out);
+    void        reset();
+
+    inline int  getFactor() { return m_factor; };
+
+    static int  getFactor(double rate, double decode_rate);
+
+  private:
+    int         m_factor;
+    double      m_sum;      // Of the unfinished block
+    int         m_filled;   // Samples in the unfinished block
+};
+
+#endif /* defined(__rfswitch__Decimator__) */
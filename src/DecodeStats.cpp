@@ -0,0 +1,121 @@
+/**
+ *  @file   DecodeStats.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "DecodeStats.h"
+
+#include <cstring>
+
+static const char* REJECT_NAMES[REJECT_COUNT] = {
+  "short_run", "few_runs", "too_long", "timing", "symbol"
+};
+
+DecodeStats::DecodeStats()
+{
+  memset(this, 0, sizeof(*this));
+};
+
+const char* DecodeStats::getRejectName(int reason)
+{
+  return REJECT_NAMES[reason];
+};
+
+void DecodeStats::merge(const DecodeStats& other)
+{
+  samples     += other.samples;
+  buffers     += other.buffers;
+  runs        += other.runs;
+  frames      += other.frames;
+  codes       += other.codes;
+  rewinds     += other.rewinds;
+  evictions   += other.evictions;
+  candidates  += other.candidates;
+  busy        += other.busy;
+
+  for (int i=0; i < REJECT_COUNT; i++) {
+    rejects[i] += other.rejects[i];
+  }
+  for (int i=0; i < STATS_BUCKETS; i++) {
+    histogram[i] += other.histogram[i];
+  }
+};
+
+/**
+ *  Returns the buffer time (in ns) that ``p`` of all buffers
+ *  took no longer than, as the middle of its bucket.
+ */
+int64_t DecodeStats::percentile(double p) const
+{
+  long rank = (long)(p * buffers);
+  long seen = 0;
+
+  if (buffers == 0) {
+    return 0;
+  }
+
+  for (int i=0; i < STATS_BUCKETS; i++) {
+    seen += histogram[i];
+    if (seen > rank) {
+      if (i < 8) {
+        return i;
+      }
+      int64_t width = (int64_t)1 << (i/4 - 2);
+      return (4 + i%4) * width + width/2;
+    }
+  }
+
+  return (int64_t)1 << (STATS_BUCKETS/4);
+};
+
+/**
+ *  Fraction of real time spent decoding, for input at ``rate``.
+ */
+double DecodeStats::getLoad(double rate) const
+{
+  if (samples == 0) {
+    return 0;
+  }
+  return busy / (samples / rate * 1e9);
+};
+
+void DecodeStats::report(FILE* fh, double rate) const
+{
+  double load   = this->getLoad(rate);
+  double budget = buffers ? samples / (double)buffers / rate * 1e9 : 0;
+
+  fprintf(fh, "  samples:    %ld in %ld buffers (%ld runs)\n", samples, buffers, runs);
+  fprintf(fh, "  frames:     %ld (%ld codes)\n", frames, codes);
+  fprintf(fh, "  rejected:  ");
+  for (int i=0; i < REJECT_COUNT; i++) {
+    fprintf(fh, " %s %ld", REJECT_NAMES[i], rejects[i]);
+  }
+  fprintf(fh, "\n");
+  fprintf(fh, "  candidates: %ld held, %ld evicted\n", candidates, evictions);
+  fprintf(fh, "  rewinds:    %ld\n", rewinds);
+  fprintf(fh, "  buffer:     p50 %lld ns, p99 %lld ns (budget %.0f ns)\n",
+          (long long)this->percentile(0.5), (long long)this->percentile(0.99), budget);
+  if (load > 0) {
+    fprintf(fh, "  load:       %.3f%% of real time (about %.0f channels per core)\n",
+            load*100, 1/load);
+  }
+};
+
+/**
+ *  Writes the counters as one ``key=value`` line.
+ */
+void DecodeStats::dump(FILE* fh, const char* source, double rate) const
+{
+  double budget = buffers ? samples / (double)buffers / rate * 1e9 : 0;
+
+  fprintf(fh, "stats source=%s samples=%ld buffers=%ld runs=%ld frames=%ld codes=%ld",
+          source, samples, buffers, runs, frames, codes);
+  for (int i=0; i < REJECT_COUNT; i++) {
+    fprintf(fh, " reject_%s=%ld", REJECT_NAMES[i], rejects[i]);
+  }
+  fprintf(fh, " candidates=%ld evictions=%ld rewinds=%ld p50_ns=%lld p99_ns=%lld"
+              " budget_ns=%.0f load=%.5f\n",
+          candidates, evictions, rewinds, (long long)this->percentile(0.5),
+          (long long)this->percentile(0.99), budget, this->getLoad(rate));
+};
@@ -0,0 +1,69 @@
+/**
+ *  @file   DecodeStats.h
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Counters kept by every Sampler, cheap enough to leave on:
+ *  what went in (samples, buffers, runs), what came out
+ *  (frames, codes), why frames were thrown away, and how
+ *  long each buffer took to decode.  Buffer times go into a
+ *  fixed histogram with four buckets per octave, so p50/p99
+ *  are known to within about 10% without storing samples.
+ *
+ */
+
+#ifndef __rfswitch__DecodeStats__
+#define __rfswitch__DecodeStats__
+
+#include "Code.h"
+
+#include <cstdio>
+#include <stdint.h>
+
+// Four buckets per power of two, from 1 ns up
+#define STATS_BUCKETS (4*40)
+
+struct DecodeStats {
+  DecodeStats();
+
+  long    samples;
+  long    buffers;
+  long    runs;
+  long    frames;
+  long    codes;
+  long    rewinds;      // Times samples were lost and the decoder restarted
+  long    evictions;    // Candidates pushed out by new codes
+  long    candidates;   // Candidates held right now
+  long    rejects[REJECT_COUNT];
+
+  int64_t busy;         // Total ns spent decoding
+  long    histogram[STATS_BUCKETS];
+
+  inline void addBuffer(int64_t ns, int length) {
+    int bucket = bucket_of(ns);
+
+    samples += length;
+    buffers++;
+    busy    += ns;
+    histogram[bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS-1]++;
+  };
+
+  void    merge(const DecodeStats& other);
+  int64_t percentile(double p) const;
+  double  getLoad(double rate) const;
+
+  void    report(FILE* fh, double rate) const;
+  void    dump(FILE* fh, const char* source, double rate) const;
+
+  static const char* getRejectName(int reason);
+
+  private:
+    static inline int bucket_of(int64_t ns) {
+      if (ns < 4) {
+        return ns > 0 ? (int)ns : 0;
+      }
+      int octave = 63 - __builtin_clzll((unsigned long long)ns);
+      return octave*4 + (int)((ns >> (octave-2)) & 3);
+    };
+};
+
+#endif /* defined(__rfswitch__DecodeStats__) */
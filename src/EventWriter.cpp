@@ -0,0 +1,117 @@
+/**
+ *  @file   EventWriter.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "EventWriter.h"
+
+#include <cstring>
+
+EventWriter::EventWriter(FILE* out)
+: m_out(out), m_head(0), m_count(0), m_written(0), m_dropped(0),
+  m_blocking(false), m_stop(false)
+{};
+
+EventWriter::~EventWriter()
+{
+  this->stop();
+};
+
+void EventWriter::start()
+{
+  m_stop    = false;
+  m_thread  = std::thread(&EventWriter::run, this);
+};
+
+/**
+ *  Writes out whatever is still queued and ends the thread.
+ */
+void EventWriter::stop()
+{
+  if (!m_thread.joinable()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stop = true;
+  }
+  m_ready.notify_one();
+  m_thread.join();
+};
+
+/**
+ *  Queues ``line`` (which should end in a newline).  Returns
+ *  false, and counts the line as dropped, if the queue is full
+ *  (and the writer isn't blocking) or the line is too long.
+ */
+bool EventWriter::write(const char* line)
+{
+  size_t length = strlen(line);
+
+  {
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (m_blocking && m_count == EVENT_QUEUE_SIZE && m_thread.joinable()) {
+      m_room.wait(lock);
+    }
+
+    if (m_count == EVENT_QUEUE_SIZE || length >= EVENT_LINE_SIZE) {
+      m_dropped++;
+      return false;
+    }
+
+    memcpy(m_lines[(m_head + m_count) % EVENT_QUEUE_SIZE], line, length+1);
+    m_count++;
+  }
+
+  m_ready.notify_one();
+  return true;
+};
+
+long EventWriter::getWritten()
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_written;
+};
+
+long EventWriter::getDropped()
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_dropped;
+};
+
+void EventWriter::run()
+{
+  char line[EVENT_LINE_SIZE];
+
+  for (;;)
+  {
+    bool last;
+
+    {
+      std::unique_lock<std::mutex> lock(m_lock);
+
+      while (m_count == 0 && !m_stop) {
+        m_ready.wait(lock);
+      }
+      if (m_count == 0) {
+        return;
+      }
+
+      strcpy(line, m_lines[m_head]);
+      m_head = (m_head + 1) % EVENT_QUEUE_SIZE;
+      m_count--;
+      m_written++;
+      last = (m_count == 0);
+    }
+    m_room.notify_one();
+
+    // Only this thread ever waits on the output
+    fputs(line, m_out);
+    if (last) {
+      fflush(m_out);
+    }
+  }
+};
@@ -0,0 +1,63 @@
+/**
+ *  @file   EventWriter.h
+ *  @class  EventWriter
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Hands lines of output to a thread of their own, so that
+ *  a slow reader on the other end of a pipe can only ever
+ *  hold up that thread.  Lines wait in a fixed queue; when
+ *  it is full, new lines are dropped (and counted) rather
+ *  than blocking the caller.  Decoding a file has no
+ *  deadline to meet, so a blocking writer waits for room
+ *  instead.
+ *
+ */
+
+#ifndef __rfswitch__EventWriter__
+#define __rfswitch__EventWriter__
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+// Lines queued at once, and the longest line kept
+#define EVENT_QUEUE_SIZE  (256)
+#define EVENT_LINE_SIZE   (512)
+
+class EventWriter {
+  public:
+    EventWriter(FILE* out);
+    ~EventWriter();
+
+    void        start();
+    void        stop();
+    bool        write(const char* line);
+
+    inline void setBlocking(bool blocking) { m_blocking = blocking; };
+
+    long        getWritten();
+    long        getDropped();
+
+  private:
+    EventWriter(const EventWriter&);
+    EventWriter& operator=(const EventWriter&);
+
+    void        run();
+
+    FILE*                   m_out;
+    char                    m_lines[EVENT_QUEUE_SIZE][EVENT_LINE_SIZE];
+    int                     m_head;
+    int                     m_count;
+    long                    m_written;
+    long                    m_dropped;
+    bool                    m_blocking;
+    bool                    m_stop;
+
+    std::mutex              m_lock;
+    std::condition_variable m_ready;  // A line was queued
+    std::condition_variable m_room;   // A line was taken
+    std::thread             m_thread;
+};
+
+#endif /* defined(__rfswitch__EventWriter__) */
@@ -0,0 +1,325 @@
+/**
+ *  @file   Gpio.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Based on the work by Geoff Johnson.
+ *
+ */
+#include "config.h"
+#include "Gpio.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_GPIO_H
+#include <linux/gpio.h>
+#endif
+
+#define BCM2708_PERI_BASE 0x20000000
+#define GPIO_OFFSET       0x200000    /* GPIO controller */
+#define BLOCK_SIZE        (4*1024)
+
+// GPIO setup macros. Always use INP_GPIO(x) before using OUT_GPIO(x) or SET_GPIO_ALT(x,y)
+#define INP_GPIO(gpio,g) *((gpio)+((g)/10)) &= ~(7<<(((g)%10)*3))
+#define OUT_GPIO(gpio,g) *((gpio)+((g)/10)) |=  (1<<(((g)%10)*3))
+
+#define GPIO_SET_REG  7   // sets   bits which are 1 ignores bits which are 0
+#define GPIO_CLR_REG  10  // clears bits which are 1 ignores bits which are 0
+
+/**
+ *  Creates a backend from a spec of the form ``name[:arg]``:
+ *  ``mem``, ``gpiomem``, ``chip[:/dev/gpiochipN]``,
+ *  ``sim[:path]`` or ``auto``, which prefers /dev/gpiomem
+ *  and falls back to /dev/mem.  Returns NULL for an unknown
+ *  backend.
+ */
+Gpio* Gpio::create(const char* spec)
+{
+  string      name  = spec;
+  const char* arg   = NULL;
+  size_t      colon = name.find(':');
+
+  if (colon != string::npos) {
+    arg   = spec + colon + 1;
+    name  = name.substr(0, colon);
+  }
+
+  if (name == "auto") {
+    name = (access("/dev/gpiomem", R_OK|W_OK) == 0) ? "gpiomem" : "mem";
+  }
+
+  if (name == "mem") {
+    return new MemGpio("/dev/mem", MemGpio::getPeripheralBase() + GPIO_OFFSET, "mem");
+  } else if (name == "gpiomem") {
+    return new MemGpio("/dev/gpiomem", 0, "gpiomem");
+  } else if (name == "chip") {
+    return new ChipGpio(arg ? arg : "/dev/gpiochip0");
+  } else if (name == "sim") {
+    return new SimGpio(arg ? arg : "");
+  }
+
+  return NULL;
+};
+
+/**
+ *  Parses a pin number, which must be the whole of ``text``
+ *  and no higher than GPIO_MAX_PIN.
+ */
+bool Gpio::parsePin(const char* text, int& pin)
+{
+  char* end;
+  long  value = strtol(text, &end, 10);
+
+  if (*text == 0 || *end != 0 || value < 0 || value > GPIO_MAX_PIN) {
+    return false;
+  }
+
+  pin = (int)value;
+  return true;
+};
+
+MemGpio::MemGpio(const char* device, uint32_t base, const char* name)
+: m_device(device), m_name(name), m_base(base), m_map(MAP_FAILED), m_gpio(NULL),
+  m_set(NULL), m_clr(NULL), m_bit(0)
+{};
+
+MemGpio::~MemGpio()
+{
+  this->close();
+};
+
+/**
+ *  Works out where the peripherals live on this board from
+ *  the device tree, falling back to the original BCM2708
+ *  address.
+ */
+uint32_t MemGpio::getPeripheralBase()
+{
+  uint32_t      base  = BCM2708_PERI_BASE;
+  unsigned char buf[12];
+  FILE*         fh    = fopen("/proc/device-tree/soc/ranges", "rb");
+
+  if (fh != NULL) {
+    size_t n = fread(buf, 1, sizeof(buf), fh);
+
+    if (n >= 8) {
+      base = (buf[4] << 24) | (buf[5] << 16) | (buf[6] << 8) | buf[7];
+
+      // Boards with 64-bit parent addresses (BCM2711) carry it one cell later
+      if (base == 0 && n >= 12) {
+        base = (buf[8] << 24) | (buf[9] << 16) | (buf[10] << 8) | buf[11];
+      }
+    }
+    fclose(fh);
+  }
+
+  return base ? base : BCM2708_PERI_BASE;
+};
+
+RF_ERROR MemGpio::open(int pin)
+{
+  // The pin picks which registers get written
+  if (!Gpio::isValidPin(pin)) {
+    return RFE_INVALID_ARGS;
+  }
+
+  int fd = ::open(m_device, O_RDWR|O_SYNC);
+
+  if (fd < 0) {
+    printf("Error: Can't open %s\n", m_device);
+    return RFE_GPIO_NO_ACCESS;
+  }
+
+  m_map = mmap(NULL, BLOCK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, m_base);
+  ::close(fd);
+
+  if (m_map == MAP_FAILED) {
+    printf("Error: mmap of %s failed\n", m_device);
+    return RFE_GPIO_NO_ACCESS;
+  }
+
+  // Always use volatile pointer!
+  m_gpio  = (volatile uint32_t*)m_map;
+  m_set   = m_gpio + GPIO_SET_REG + pin/32;
+  m_clr   = m_gpio + GPIO_CLR_REG + pin/32;
+  m_bit   = 1u << (pin%32);
+
+  // Switch the pin to output mode; must use INP_GPIO before we can use OUT_GPIO
+  INP_GPIO(m_gpio, pin);
+  OUT_GPIO(m_gpio, pin);
+
+  return RFE_NO_ERROR;
+};
+
+void MemGpio::close()
+{
+  if (m_map != MAP_FAILED) {
+    munmap(m_map, BLOCK_SIZE);
+    m_map   = MAP_FAILED;
+    m_gpio  = NULL;
+  }
+};
+
+ChipGpio::ChipGpio(const char* device)
+: m_device(device), m_fd(-1)
+{};
+
+ChipGpio::~ChipGpio()
+{
+  this->close();
+};
+
+RF_ERROR ChipGpio::open(int pin)
+{
+  if (!Gpio::isValidPin(pin)) {
+    return RFE_INVALID_ARGS;
+  }
+
+#ifdef HAVE_LINUX_GPIO_H
+  int chip = ::open(m_device.c_str(), O_RDWR);
+
+  if (chip < 0) {
+    printf("Error: Can't open %s\n", m_device.c_str());
+    return RFE_GPIO_NO_ACCESS;
+  }
+
+  struct gpiohandle_request req;
+  memset(&req, 0, sizeof(req));
+
+  req.lineoffsets[0]  = pin;
+  req.lines           = 1;
+  req.flags           = GPIOHANDLE_REQUEST_OUTPUT;
+  strncpy(req.consumer_label, "rfswitch", sizeof(req.consumer_label)-1);
+
+  int rc = ioctl(chip, GPIO_GET_LINEHANDLE_IOCTL, &req);
+  ::close(chip);
+
+  if (rc < 0) {
+    printf("Error: Can't request line %d on %s\n", pin, m_device.c_str());
+    return RFE_GPIO_NO_ACCESS;
+  }
+
+  m_fd = req.fd;
+  return RFE_NO_ERROR;
+#else
+  printf("Error: gpiochip support not available\n");
+  return RFE_GPIO_NO_ACCESS;
+#endif
+};
+
+void ChipGpio::write(int value)
+{
+#ifdef HAVE_LINUX_GPIO_H
+  struct gpiohandle_data data;
+  memset(&data, 0, sizeof(data));
+
+  data.values[0] = value;
+  ioctl(m_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data);
+#endif
+};
+
+void ChipGpio::set()
+{
+  this->write(1);
+};
+
+void ChipGpio::clear()
+{
+  this->write(0);
+};
+
+void ChipGpio::close()
+{
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+};
+
+SimGpio::SimGpio(const char* path)
+: m_path(path), m_dropped(0)
+{};
+
+SimGpio::~SimGpio()
+{
+  this->close();
+};
+
+RF_ERROR SimGpio::open(int pin)
+{
+  if (!Gpio::isValidPin(pin)) {
+    return RFE_INVALID_ARGS;
+  }
+
+  // Reserve up front so recording never allocates mid-burst
+  m_events.clear();
+  m_events.reserve(SIM_EDGE_CAPACITY);
+  m_dropped = 0;
+
+  return RFE_NO_ERROR;
+};
+
+void SimGpio::record(int level)
+{
+  if (m_events.size() >= SIM_EDGE_CAPACITY) {
+    m_dropped++;
+    return;
+  }
+
+  timespec ts;
+  Timeline::now(ts);
+
+  Event event;
+  event.time  = ts.tv_sec*1000000000LL + ts.tv_nsec;
+  event.level = level;
+
+  m_events.push_back(event);
+};
+
+void SimGpio::set()
+{
+  this->record(1);
+};
+
+void SimGpio::clear()
+{
+  this->record(0);
+};
+
+/**
+ *  Writes the recorded edges as ``<ns since first edge> <level>``
+ *  lines, if a path was given.
+ */
+void SimGpio::close()
+{
+  if (m_path.empty() || m_events.empty()) {
+    return;
+  }
+
+  FILE* fh = (m_path == "-") ? stdout : fopen(m_path.c_str(), "w");
+  if (fh == NULL) {
+    printf("Error: Can't write %s\n", m_path.c_str());
+    return;
+  }
+
+  int64_t start = m_events[0].time;
+
+  fprintf(fh, "# rfswitch simulated edges: %d recorded, %ld dropped\n",
+          (int)m_events.size(), m_dropped);
+
+  for (size_t i=0; i < m_events.size(); i++) {
+    fprintf(fh, "%lld %d\n", (long long)(m_events[i].time - start), m_events[i].level);
+  }
+
+  if (fh != stdout) {
+    fclose(fh);
+  }
+
+  // Only write once
+  m_path.clear();
+};
@@ -0,0 +1,126 @@
+/**
+ *  @file   Gpio.h
+ *  @class  Gpio
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Output backends for driving the RF transmitter pin.
+ *
+ *    mem       BCM283x registers mapped from /dev/mem (root)
+ *    gpiomem   The same registers via /dev/gpiomem (no root)
+ *    chip      The Linux gpiochip character device
+ *    sim       No hardware; every edge is timestamped and
+ *              kept in memory, optionally written to a file
+ *
+ *  The register backends keep the single store per edge that
+ *  transmit timing depends on.
+ *
+ */
+
+#ifndef __rfswitch__Gpio__
+#define __rfswitch__Gpio__
+
+#include "error.h"
+#include "Timeline.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Default GPIO pin the RF transmitter is connected to
+#define GPIO_DEFAULT_PIN  (7)
+
+// Highest pin the BCM283x GPIO registers cover
+#define GPIO_MAX_PIN      (53)
+
+// Edges the simulated backend can hold before it starts dropping
+#define SIM_EDGE_CAPACITY (1<<16)
+
+class Gpio {
+  public:
+    virtual ~Gpio() {};
+
+    virtual RF_ERROR    open(int pin) = 0;
+    virtual void        set() = 0;
+    virtual void        clear() = 0;
+    virtual void        close() {};
+    virtual const char* getName() = 0;
+
+    static Gpio*        create(const char* spec);
+    static bool         parsePin(const char* text, int& pin);
+
+    static inline bool  isValidPin(int pin) { return pin >= 0 && pin <= GPIO_MAX_PIN; };
+};
+
+class MemGpio : public Gpio {
+  public:
+    MemGpio(const char* device, uint32_t base, const char* name);
+    ~MemGpio();
+
+    RF_ERROR    open(int pin);
+    void        close();
+    const char* getName() { return m_name; };
+
+    inline void set()   { *m_set = m_bit; };
+    inline void clear() { *m_clr = m_bit; };
+
+    static uint32_t getPeripheralBase();
+
+  private:
+    const char*         m_device;
+    const char*         m_name;
+    uint32_t            m_base;
+    void*               m_map;
+    volatile uint32_t*  m_gpio;
+    volatile uint32_t*  m_set;
+    volatile uint32_t*  m_clr;
+    uint32_t            m_bit;
+};
+
+class ChipGpio : public Gpio {
+  public:
+    ChipGpio(const char* device);
+    ~ChipGpio();
+
+    RF_ERROR    open(int pin);
+    void        set();
+    void        clear();
+    void        close();
+    const char* getName() { return "chip"; };
+
+  private:
+    void        write(int value);
+
+    string      m_device;
+    int         m_fd;
+};
+
+class SimGpio : public Gpio {
+  public:
+    struct Event {
+      int64_t time;   // CLOCK_MONOTONIC, ns
+      int     level;
+    };
+
+    SimGpio(const char* path);
+    ~SimGpio();
+
+    RF_ERROR    open(int pin);
+    void        set();
+    void        clear();
+    void        close();
+    const char* getName() { return "sim"; };
+
+    inline const vector<Event>& getEvents()  { return m_events; };
+    inline long                 getDropped() { return m_dropped; };
+
+  private:
+    void        record(int level);
+
+    string        m_path;
+    vector<Event> m_events;
+    long          m_dropped;
+};
+
+#endif /* defined(__rfswitch__Gpio__) */
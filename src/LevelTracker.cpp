@@ -0,0 +1,126 @@
+/**
+ *  @file   LevelTracker.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "LevelTracker.h"
+
+#include <cmath>
+
+LevelTracker::LevelTracker(float threshold)
+: m_initial(threshold)
+{
+  this->reset();
+};
+
+void LevelTracker::reset()
+{
+  m_threshold = m_initial;
+  m_rising    = m_initial;
+  m_falling   = m_initial;
+  m_floor     = 0;
+  m_noise     = 0;
+  m_signal    = 0;
+  m_primed    = false;
+  m_seen      = false;
+};
+
+template <typename T>
+void LevelTracker::update(const T* buffer, int length)
+{
+  float lo_sum  = 0,
+        lo_sq   = 0,
+        hi_sum  = 0;
+  int   lo_n    = 0,
+        hi_n    = 0;
+
+  for (int i=0; i < length; i += TRACKER_STRIDE) {
+    float x = SampleTraits<T>::toLevel(buffer[i]);
+
+    if (x > m_threshold) {
+      hi_sum += x;
+      hi_n++;
+    } else {
+      lo_sum += x;
+      lo_sq  += x*x;
+      lo_n++;
+    }
+  }
+
+  if (lo_n > 1) {
+    float mean  = lo_sum / lo_n;
+    float var   = lo_sq / lo_n - mean*mean;
+    float sigma = (var > 0) ? sqrtf(var) : 0;
+
+    if (!m_primed) {
+      m_floor   = mean;
+      m_noise   = sigma;
+      m_primed  = true;
+    } else {
+      m_floor  += TRACKER_FLOOR_ALPHA * (mean - m_floor);
+      m_noise  += TRACKER_FLOOR_ALPHA * (sigma - m_noise);
+    }
+  }
+
+  if (hi_n > 0) {
+    float mean = hi_sum / hi_n;
+
+    if (!m_seen) {
+      m_signal  = mean;
+      m_seen    = true;
+    } else {
+      m_signal += TRACKER_SIGNAL_ALPHA * (mean - m_signal);
+    }
+  } else if (m_seen) {
+    m_signal += TRACKER_DECAY_ALPHA * (m_floor - m_signal);
+  }
+
+  if (m_primed) {
+    this->set_threshold();
+  }
+};
+
+template void LevelTracker::update<int16_t>(const int16_t* buffer, int length);
+template void LevelTracker::update<int32_t>(const int32_t* buffer, int length);
+template void LevelTracker::update<float>(const float* buffer, int length);
+
+void LevelTracker::set_threshold()
+{
+  float margin = TRACKER_NOISE_SIGMAS * m_noise;
+  if (margin < TRACKER_MIN_MARGIN) {
+    margin = TRACKER_MIN_MARGIN;
+  }
+
+  float threshold = m_floor + margin;
+
+  if (m_seen) {
+    float middle = m_floor + (m_signal - m_floor) / 2;
+    if (middle > threshold) {
+      threshold = middle;
+    }
+  }
+
+  m_threshold = threshold;
+  m_falling   = threshold - TRACKER_HYSTERESIS * (threshold - m_floor);
+  m_rising    = threshold + TRACKER_HYSTERESIS * (threshold - m_floor);
+
+  // Never ask a pulse to rise beyond the level pulses reach
+  if (m_seen && m_rising > m_signal) {
+    m_rising = threshold;
+  }
+};
+
+/**
+ *  Signal-to-noise ratio in dB, or 0 until a signal has been
+ *  seen.  Noise below one 16-bit step counts as one step.
+ */
+float LevelTracker::getSNR()
+{
+  float noise = (m_noise > TRACKER_MIN_NOISE) ? m_noise : TRACKER_MIN_NOISE;
+
+  if (!m_seen || m_signal <= m_floor) {
+    return 0;
+  }
+  return 20 * log10f((m_signal - m_floor) / noise);
+};
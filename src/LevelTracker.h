@@ -0,0 +1,78 @@
+/**
+ *  @file   LevelTracker.h
+ *  @class  LevelTracker
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Follows the noise floor and signal level of the input so
+ *  the 1/0 threshold can adapt to the receiver's gain and
+ *  distance instead of being fixed at SIGNAL_THRESH.
+ *
+ *  Each buffer is looked at once, every TRACKER_STRIDE-th
+ *  sample: samples below the current threshold update the
+ *  floor and its spread, samples above it the signal level.
+ *  The threshold sits halfway between floor and signal, but
+ *  never within TRACKER_NOISE_SIGMAS of the floor, and
+ *  is split into a higher rising and a lower falling edge
+ *  (hysteresis) so noise riding on a pulse can't chop it up.
+ *  Levels are floats in [-1, 1] whatever the sample type.
+ *
+ */
+
+#ifndef __rfswitch__LevelTracker__
+#define __rfswitch__LevelTracker__
+
+#include "SampleType.h"
+
+// Only every Nth sample feeds the estimate
+#define TRACKER_STRIDE        (4)
+
+// How far above the noise floor the threshold must stay
+#define TRACKER_NOISE_SIGMAS  (6.0f)
+#define TRACKER_MIN_MARGIN    (0.002f)
+
+// Quietest noise the SNR is measured against (one 16-bit step)
+#define TRACKER_MIN_NOISE     (1.0f/32768)
+
+// Rising/falling thresholds sit this fraction of the way
+// from the threshold towards the signal/floor
+#define TRACKER_HYSTERESIS    (0.25f)
+
+// Per-buffer smoothing of the floor, and of the signal level;
+// without pulses the signal level slowly sinks back to the
+// floor so a weaker transmitter is picked up again
+#define TRACKER_FLOOR_ALPHA   (0.05f)
+#define TRACKER_SIGNAL_ALPHA  (0.25f)
+#define TRACKER_DECAY_ALPHA   (0.01f)
+
+class LevelTracker {
+  public:
+    LevelTracker(float threshold);
+
+    template <typename T>
+    void        update(const T* buffer, int length);
+    void        reset();
+
+    inline float  getThreshold()  { return m_threshold; };
+    inline float  getRising()     { return m_rising; };
+    inline float  getFalling()    { return m_falling; };
+    inline float  getFloor()      { return m_floor; };
+    inline float  getNoise()      { return m_noise; };
+    inline float  getSignal()     { return m_signal; };
+    float         getSNR();
+
+  private:
+    void        set_threshold();
+
+    float       m_initial;
+    float       m_threshold;
+    float       m_rising;
+    float       m_falling;
+
+    float       m_floor;    // Mean of the samples below the threshold
+    float       m_noise;    // and their standard deviation
+    float       m_signal;   // Mean of the samples above it
+    bool        m_primed;
+    bool        m_seen;     // Whether any signal has been seen
+};
+
+#endif /* defined(__rfswitch__LevelTracker__) */
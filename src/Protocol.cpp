@@ -0,0 +1,119 @@
+/**
+ *  @file   Protocol.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "Protocol.h"
+
+/**
+ *  Built-in protocols.  PT2262 sends 12 tri-state symbols as
+ *  pairs of bits ('0' = 00, '1' = 11, 'F' = 01); EV1527 sends
+ *  24 plain bits with the same pulses.  Both start each frame
+ *  with a 1:31 sync.
+ */
+constexpr ProtocolSpec PROTOCOL_PT2262 = {
+  "pt2262", {1, 31}, {1, 3}, {3, 1}, 2, "0F?1", 25, 24
+};
+
+constexpr ProtocolSpec PROTOCOL_EV1527 = {
+  "ev1527", {1, 31}, {1, 3}, {3, 1}, 1, "01", 25, 24
+};
+
+LegacyMatcher::LegacyMatcher(double rate)
+: Matcher(rate), m_mode(MODE_COUNT_ZEROES), m_code((int)(rate * MIN_BIT_TIME + 0.5))
+{};
+
+void LegacyMatcher::reset()
+{
+  // Wait for a fresh gap before trusting the signal again
+  m_mode = MODE_COUNT_ZEROES;
+  m_code.reset();
+};
+
+bool LegacyMatcher::addRun(int level, int length)
+{
+  if (level == 1) {
+    if (m_mode == MODE_WAIT_HI) {
+      m_mode = MODE_READ_CODE;
+      m_code.reset();
+    }
+
+    if (m_mode != MODE_READ_CODE) {
+      return false;
+    }
+
+    if (!m_code.addRun(1, length)) {
+      // Rejected; skip to the next gap
+      m_rejects[m_code.getReason()]++;
+      m_mode = MODE_COUNT_ZEROES;
+    }
+
+    return false;
+  }
+
+  if (length < m_gap) {
+    if (m_mode == MODE_READ_CODE && !m_code.addRun(0, length)) {
+      m_rejects[m_code.getReason()]++;
+      m_mode = MODE_COUNT_ZEROES;
+    }
+    return false;
+  }
+
+  // A long run of zeroes is the gap between two codes
+  if (m_mode == MODE_READ_CODE) {
+    return this->end_code();
+  }
+
+  m_mode = MODE_WAIT_HI;
+  return false;
+};
+
+bool LegacyMatcher::addPending(int level, int length)
+{
+  // Don't wait for the next edge to finish a code once the
+  // trailing gap is already long enough
+  if (m_mode == MODE_READ_CODE && level == 0 && length >= m_gap) {
+    return this->end_code();
+  }
+  return false;
+};
+
+bool LegacyMatcher::end_code()
+{
+  m_mode = MODE_WAIT_HI;
+
+  if (!m_code.validate()) {
+    m_rejects[m_code.getReason()]++;
+    return false;
+  }
+
+  strcpy(m_frame.code, m_code.getCodeString());
+  strcpy(m_frame.bits, m_frame.code);
+
+  m_frame.protocol    = "legacy";
+  m_frame.timings[0]  = m_code.getLength(3);  // hi-short
+  m_frame.timings[1]  = m_code.getLength(0);  // lo-long
+  m_frame.timings[2]  = m_code.getLength(1);  // hi-long
+  m_frame.timings[3]  = m_code.getLength(2);  // lo-short
+
+  return true;
+};
+
+/**
+ *  Fills ``matchers`` with one matcher per known protocol, for
+ *  runs measured at ``rate``, and returns how many were created.
+ *  Where two protocols read the same frame, the Sampler keeps
+ *  the reading of the one listed first, so PT2262 (whose
+ *  alphabet rejects some bit pairs) comes before EV1527.
+ */
+int create_matchers(Matcher** matchers, int max, double rate)
+{
+  int count = 0;
+
+  if (count < max) matchers[count++] = new LegacyMatcher(rate);
+  if (count < max) matchers[count++] = new ProtocolMatcher<PROTOCOL_PT2262>(rate);
+  if (count < max) matchers[count++] = new ProtocolMatcher<PROTOCOL_EV1527>(rate);
+
+  return count;
+};
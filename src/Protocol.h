@@ -0,0 +1,346 @@
+/**
+ *  @file   Protocol.h
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Line-code descriptors and the matchers that decode them.
+ *
+ *  Every protocol is described by a ``ProtocolSpec`` table:
+ *  an optional sync pulse, the pulse pair for a 0 bit and a
+ *  1 bit (all in units of the protocol's base period), how
+ *  bits group into symbols, the timing tolerance and the
+ *  number of bits in a frame.  ``ProtocolMatcher`` is
+ *  instantiated once per table, so each matcher is compiled
+ *  with its ratios and tolerances as constants.
+ *
+ *  All matchers are fed the same run-length stream and
+ *  report complete frames independently.  The original
+ *  adaptive decoder, which learns the long/short split from
+ *  each frame, is kept as the ``legacy`` protocol.
+ *
+ *  Adding a protocol means adding a table to Protocol.cpp
+ *  and listing it in ``create_matchers``.
+ *
+ */
+
+#ifndef __rfswitch__Protocol__
+#define __rfswitch__Protocol__
+
+#include "Code.h"
+#include "record.h"
+
+#include <cstring>
+
+// Most matchers a Sampler runs side by side
+#define MAX_MATCHERS      (8)
+
+// Shortest base period (in seconds) a sync pulse may imply
+#define PROTOCOL_MIN_UNIT_TIME (90e-6)
+
+struct PulsePair {
+  int hi;   // Length of the high pulse, in units
+  int lo;   // Length of the low pulse that follows it
+};
+
+struct ProtocolSpec {
+  const char* name;
+  PulsePair   sync;             // {0, 0} if frames are only separated by a gap
+  PulsePair   zero;             // A 0 bit
+  PulsePair   one;              // A 1 bit
+  int         bits_per_symbol;  // 1 for binary codes, 2 for tri-state
+  const char* alphabet;         // Symbol for each group of bits, MSB first; '?' is invalid
+  int         tolerance;        // Percent each pulse may differ from the table
+  int         bits;             // Bits per frame
+};
+
+// A decoded frame.  ``bits`` and ``timings`` are in the form
+// the config file uses, so any protocol can be sent back out.
+struct Frame {
+  const char* protocol;
+  char        code[MAX_CODE_BITS+1];  // In the protocol's symbols
+  char        bits[MAX_CODE_BITS+1];
+  int         timings[4];             // short-hi, long-lo, long-hi, short-lo, in samples
+};
+
+class Matcher {
+  public:
+    Matcher(double rate)
+    : m_gap(rate * ZERO_PREAMBLE_TIME)
+    {
+      memset(m_rejects, 0, sizeof(m_rejects));
+    };
+    virtual ~Matcher() {};
+
+    // Each returns true once a frame is complete; it is then in getFrame()
+    virtual bool        addRun(int level, int length) = 0;
+    virtual bool        addPending(int level, int length) = 0;
+    virtual void        reset() = 0;
+
+    inline const Frame& getFrame()              { return m_frame; };
+    inline long         getRejects(int reason)  { return m_rejects[reason]; };
+
+  protected:
+    double              m_gap;    // ZERO_PREAMBLE_TIME, in samples
+    Frame               m_frame;
+    long                m_rejects[REJECT_COUNT];  // Frames thrown away, by REJECT
+};
+
+/**
+ *  The original decoder: frames are delimited by gaps, and
+ *  each pulse is long or short relative to the frame's own
+ *  mean, so any pulse ratio is accepted.
+ */
+class LegacyMatcher : public Matcher {
+  public:
+    LegacyMatcher(double rate);
+
+    bool        addRun(int level, int length);
+    bool        addPending(int level, int length);
+    void        reset();
+
+  private:
+    bool        end_code();
+
+    enum MODE {
+      MODE_COUNT_ZEROES,  // Wait for a gap of ZERO_PREAMBLE_TIME
+      MODE_WAIT_HI,       // Once the gap is long enough, this will wait for a `1`
+      MODE_READ_CODE
+    };
+
+    MODE        m_mode;
+    Code        m_code;
+};
+
+/**
+ *  Decodes the fixed-ratio line code described by ``P``.
+ *  The base period is measured from the sync pulse (or, for
+ *  gap-delimited codes, from the first bit) and refined by
+ *  every bit that follows.
+ */
+template <const ProtocolSpec& P>
+class ProtocolMatcher : public Matcher {
+  static_assert(P.bits <= MAX_CODE_BITS, "Protocol frames must fit in a Code");
+  static_assert(P.bits % P.bits_per_symbol == 0, "Frames must hold whole symbols");
+
+  public:
+    ProtocolMatcher(double rate)
+    : Matcher(rate), m_min_unit(rate * PROTOCOL_MIN_UNIT_TIME)
+    {
+      this->reset();
+    };
+
+    void reset()
+    {
+      m_state = STATE_SYNC_HI;
+      m_hi    = 0;
+      m_count = 0;
+      m_sum   = 0;
+      m_units = 0;
+    };
+
+    bool addRun(int level, int length)
+    {
+      if (level == 1) {
+        m_hi    = length;
+        m_state = (m_state == STATE_DATA_HI) ? STATE_DATA_LO : STATE_SYNC_LO;
+        return false;
+      }
+
+      if (m_state == STATE_SYNC_LO) {
+        this->sync(length);
+        return false;
+      }
+
+      if (m_state != STATE_DATA_LO) {
+        // A gap starts a gap-delimited frame
+        if (P.sync.hi == 0 && length >= m_gap) {
+          this->start(0, 0);
+        }
+        return false;
+      }
+
+      int bit = this->match(m_hi, length, m_count == P.bits-1);
+
+      if (bit < 0) {
+        // Any short pulse before a long gap passes for a sync (the
+        // end of a legacy frame does), so as with the legacy decoder
+        // a frame is only a frame once it holds MIN_CODE_LENGTH runs
+        if (m_count*2 >= MIN_CODE_LENGTH) {
+          m_rejects[REJECT_TIMING]++;
+        }
+        // Not a bit; the pulse pair may be the start of the next frame
+        this->sync(length);
+        return false;
+      }
+
+      return this->add_bit(bit, length);
+    };
+
+    bool addPending(int level, int length)
+    {
+      // The last bit's low pulse runs on into the silence after the
+      // final frame, so don't wait for the next edge to finish it
+      if (level != 0 || m_state != STATE_DATA_LO || m_count != P.bits-1) {
+        return false;
+      }
+
+      int bit = this->match(m_hi, length, true);
+      if (bit < 0) {
+        return false;
+      }
+
+      bool found = this->add_bit(bit, length);
+
+      // Let the rest of the pulse be checked as a sync
+      m_state = STATE_SYNC_LO;
+      return found;
+    };
+
+  private:
+    enum STATE {
+      STATE_SYNC_HI,
+      STATE_SYNC_LO,
+      STATE_DATA_HI,
+      STATE_DATA_LO
+    };
+
+    static inline bool near(int length, int units, double unit, bool open)
+    {
+      double expected = units * unit;
+      double slack    = expected * P.tolerance / 100.0;
+
+      if (open) {
+        return length >= expected - slack;
+      }
+      return length >= expected - slack && length <= expected + slack;
+    };
+
+    /**
+     *  Returns the bit the pulse pair encodes, or -1.  The low
+     *  pulse of the final bit is only checked for being long
+     *  enough.
+     */
+    inline int match(int hi, int lo, bool last)
+    {
+      double unit = m_units ? (double)m_sum / m_units : 0;
+
+      if (unit == 0) {
+        // No sync, so the first bit sets the period
+        if (near(lo, P.zero.lo, (double)(hi+lo) / (P.zero.hi + P.zero.lo), false) &&
+            near(hi, P.zero.hi, (double)(hi+lo) / (P.zero.hi + P.zero.lo), false)) {
+          return 0;
+        }
+        if (near(lo, P.one.lo, (double)(hi+lo) / (P.one.hi + P.one.lo), false) &&
+            near(hi, P.one.hi, (double)(hi+lo) / (P.one.hi + P.one.lo), false)) {
+          return 1;
+        }
+        return -1;
+      }
+
+      if (near(hi, P.zero.hi, unit, false) && near(lo, P.zero.lo, unit, last)) {
+        return 0;
+      }
+      if (near(hi, P.one.hi, unit, false) && near(lo, P.one.lo, unit, last)) {
+        return 1;
+      }
+      return -1;
+    };
+
+    inline void start(int sum, int units)
+    {
+      m_state = STATE_DATA_HI;
+      m_count = 0;
+      m_sum   = sum;
+      m_units = units;
+    };
+
+    /**
+     *  Checks whether the last high pulse and the low pulse of
+     *  ``length`` form a sync, and starts a frame if they do.
+     */
+    inline void sync(int length)
+    {
+      m_state = STATE_SYNC_HI;
+
+      if (P.sync.hi == 0) {
+        if (length >= m_gap) {
+          this->start(0, 0);
+        }
+        return;
+      }
+
+      double unit = (double)(m_hi + length) / (P.sync.hi + P.sync.lo);
+
+      if (unit >= m_min_unit &&
+          near(m_hi, P.sync.hi, unit, false) && near(length, P.sync.lo, unit, false)) {
+        this->start(m_hi + length, P.sync.hi + P.sync.lo);
+      }
+    };
+
+    bool add_bit(int bit, int lo)
+    {
+      const PulsePair& pair = bit ? P.one : P.zero;
+
+      m_bits[m_count++] = '0' + bit;
+
+      if (m_count < P.bits) {
+        m_sum   += m_hi + lo;
+        m_units += pair.hi + pair.lo;
+        m_state  = STATE_DATA_HI;
+        return false;
+      }
+
+      // The final low pulse is open-ended, so it isn't measured
+      m_sum   += m_hi;
+      m_units += pair.hi;
+
+      bool found = this->emit();
+
+      // The final bit's pulses may double as the next frame's sync
+      this->sync(lo);
+      return found;
+    };
+
+    bool emit()
+    {
+      int symbols = P.bits / P.bits_per_symbol;
+
+      for (int s=0; s < symbols; s++) {
+        int value = 0;
+        for (int b=0; b < P.bits_per_symbol; b++) {
+          value = (value << 1) | (m_bits[s*P.bits_per_symbol + b] - '0');
+        }
+
+        if (P.alphabet[value] == '?') {
+          m_rejects[REJECT_SYMBOL]++;
+          return false;
+        }
+        m_frame.code[s] = P.alphabet[value];
+      }
+      m_frame.code[symbols] = 0;
+
+      memcpy(m_frame.bits, m_bits, P.bits);
+      m_frame.bits[P.bits] = 0;
+
+      double unit = (double)m_sum / m_units;
+
+      m_frame.protocol    = P.name;
+      m_frame.timings[0]  = (int)(P.zero.hi * unit + 0.5);
+      m_frame.timings[1]  = (int)(P.zero.lo * unit + 0.5);
+      m_frame.timings[2]  = (int)(P.one.hi  * unit + 0.5);
+      m_frame.timings[3]  = (int)(P.one.lo  * unit + 0.5);
+
+      return true;
+    };
+
+    double      m_min_unit;
+    STATE       m_state;
+    int         m_hi;
+    int         m_count;
+    long        m_sum;    // Samples and units measured so far,
+    int         m_units;  // giving the base period
+    char        m_bits[MAX_CODE_BITS];
+};
+
+int create_matchers(Matcher** matchers, int max, double rate);
+
+#endif /* defined(__rfswitch__Protocol__) */
@@ -0,0 +1,172 @@
+/**
+ *  @file   Realtime.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "Realtime.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <sys/mman.h>
+
+Realtime::Realtime()
+: m_scheduled(false), m_locked(false), m_pinned(false), m_cpu(-1), m_policy(SCHED_OTHER)
+{
+  memset(&m_param, 0, sizeof(m_param));
+  CPU_ZERO(&m_affinity);
+};
+
+Realtime::~Realtime()
+{
+  this->leave();
+};
+
+/**
+ *  Touches a block of stack below the caller so those pages
+ *  are already mapped (and locked) when playback needs them.
+ */
+__attribute__((noinline))
+static void prefault_stack()
+{
+  char            stack[REALTIME_STACK_PREFAULT];
+  volatile char*  page = stack;
+
+  // Written through a volatile pointer so the stores aren't dropped
+  for (int i=0; i < REALTIME_STACK_PREFAULT; i += 4096) {
+    page[i] = 0;
+  }
+};
+
+/**
+ *  Returns true if any of this process's memory is already
+ *  locked (``VmLck`` in /proc/self/status is non-zero).
+ */
+static bool memory_locked()
+{
+  char  line[128];
+  long  kb  = 0;
+  FILE* fh  = fopen("/proc/self/status", "r");
+
+  if (fh == NULL) {
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), fh) != NULL) {
+    if (sscanf(line, "VmLck: %ld", &kb) == 1) {
+      break;
+    }
+  }
+
+  fclose(fh);
+  return kb > 0;
+};
+
+/**
+ *  Returns the highest CPU listed in the kernel's
+ *  ``isolcpus`` set, or -1 if none are isolated.
+ */
+int Realtime::findIsolatedCpu()
+{
+  char  buf[256];
+  int   cpu = -1;
+  FILE* fh  = fopen("/sys/devices/system/cpu/isolated", "r");
+
+  if (fh == NULL) {
+    return -1;
+  }
+
+  if (fgets(buf, sizeof(buf), fh) != NULL) {
+    // The list looks like "2-3,5"; the last number is the highest CPU
+    char* p = buf;
+    while (*p != '\0') {
+      if (*p >= '0' && *p <= '9') {
+        cpu = (int)strtol(p, &p, 10);
+      } else {
+        p++;
+      }
+    }
+  }
+
+  fclose(fh);
+  return cpu;
+};
+
+/**
+ *  Switches to real-time operation, pinning to ``cpu`` or, if
+ *  it is negative, to an isolated CPU when there is one.  Each
+ *  step that can't be done (usually for lack of privileges) is
+ *  reported and skipped.  Returns true if SCHED_FIFO was set.
+ */
+bool Realtime::enter(int cpu)
+{
+  pthread_t self = pthread_self();
+
+  if (cpu < 0) {
+    cpu = findIsolatedCpu();
+  }
+
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if (sched_getaffinity(0, sizeof(m_affinity), &m_affinity) == 0 &&
+        sched_setaffinity(0, sizeof(set), &set) == 0) {
+      m_pinned  = true;
+      m_cpu     = cpu;
+    } else {
+      printf("Warning: Can't pin to CPU %d\n", cpu);
+    }
+  }
+
+  // Whoever locked memory before us still wants it locked, so
+  // ``leave`` only unlocks when it was all unlocked to begin with
+  bool was_locked = memory_locked();
+
+  if (mlockall(MCL_CURRENT|MCL_FUTURE) == 0) {
+    m_locked = !was_locked;
+  } else {
+    printf("Warning: Can't lock memory\n");
+  }
+
+  prefault_stack();
+
+  sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = REALTIME_PRIORITY;
+
+  if (pthread_getschedparam(self, &m_policy, &m_param) == 0 &&
+      pthread_setschedparam(self, SCHED_FIFO, &param) == 0) {
+    m_scheduled = true;
+  } else {
+    printf("Warning: Can't switch to real-time scheduling\n");
+  }
+
+  return m_scheduled;
+};
+
+/**
+ *  Restores the priority, memory locking and affinity that
+ *  were in place before ``enter``.  Memory is only unlocked if
+ *  ``enter`` was the one that locked it.
+ */
+void Realtime::leave()
+{
+  if (m_scheduled) {
+    pthread_setschedparam(pthread_self(), m_policy, &m_param);
+    m_scheduled = false;
+  }
+
+  if (m_locked) {
+    munlockall();
+    m_locked = false;
+  }
+
+  if (m_pinned) {
+    sched_setaffinity(0, sizeof(m_affinity), &m_affinity);
+    m_pinned  = false;
+    m_cpu     = -1;
+  }
+};
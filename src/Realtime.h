@@ -0,0 +1,48 @@
+/**
+ *  @file   Realtime.h
+ *  @class  Realtime
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Puts the calling thread into a state where a transmit
+ *  burst can't be interrupted: SCHED_FIFO priority, all
+ *  memory locked and faulted in, and pinned to one CPU
+ *  (an isolated one if the kernel has any).  Everything
+ *  that was changed is put back by ``leave``.
+ *
+ */
+
+#ifndef __rfswitch__Realtime__
+#define __rfswitch__Realtime__
+
+#include <pthread.h>
+#include <sched.h>
+
+// SCHED_FIFO priority used for the burst; below the kernel's own IRQ threads
+#define REALTIME_PRIORITY       (80)
+
+// Stack touched up front so playback never takes a page fault on it
+#define REALTIME_STACK_PREFAULT (64*1024)
+
+class Realtime {
+  public:
+    Realtime();
+    ~Realtime();
+
+    bool        enter(int cpu = -1);
+    void        leave();
+
+    inline int  getCpu()  { return m_cpu; };
+
+    static int  findIsolatedCpu();
+
+  private:
+    bool        m_scheduled;
+    bool        m_locked;
+    bool        m_pinned;
+    int         m_cpu;
+    int         m_policy;
+    sched_param m_param;
+    cpu_set_t   m_affinity;
+};
+
+#endif /* defined(__rfswitch__Realtime__) */
@@ -0,0 +1,124 @@
+/**
+ *  @file   RingBuffer.h
+ *  @class  RingBuffer
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  A lock-free, fixed-size ring buffer for exactly one
+ *  producer thread and one consumer thread.  It is used to
+ *  hand samples from the PortAudio callback to the decoder
+ *  without ever blocking the callback.
+ *
+ *  The read and write positions only ever increase, so they
+ *  double as running totals of the items that have passed
+ *  through the buffer.
+ *
+ */
+
+#ifndef __rfswitch__RingBuffer__
+#define __rfswitch__RingBuffer__
+
+#include <atomic>
+
+template <typename T>
+class RingBuffer {
+  public:
+    RingBuffer(unsigned long capacity)
+    : m_head(0), m_tail(0)
+    {
+      // Round up to a power of two so positions can be masked
+      m_capacity = 1;
+      while (m_capacity < capacity) {
+        m_capacity <<= 1;
+      }
+      m_mask    = m_capacity - 1;
+      m_buffer  = new T[m_capacity];
+    };
+
+    ~RingBuffer()
+    {
+      delete[] m_buffer;
+    };
+
+    /**
+     *  Producer: writes all ``count`` items, or nothing if there
+     *  isn't room for them.  Items are taken ``stride`` apart,
+     *  so one channel can be picked out of interleaved data.
+     *  Returns false if the items were dropped.
+     */
+    bool write(const T* data, unsigned long count, unsigned long stride = 1)
+    {
+      unsigned long head = m_head.load(std::memory_order_relaxed);
+      unsigned long tail = m_tail.load(std::memory_order_acquire);
+
+      if (m_capacity - (head - tail) < count) {
+        return false;
+      }
+
+      for (unsigned long i=0; i < count; i++) {
+        m_buffer[(head + i) & m_mask] = data[i*stride];
+      }
+
+      m_head.store(head + count, std::memory_order_release);
+      return true;
+    };
+
+    /**
+     *  Consumer: reads up to ``count`` items and returns the
+     *  number read.
+     */
+    unsigned long read(T* data, unsigned long count)
+    {
+      unsigned long tail  = m_tail.load(std::memory_order_relaxed);
+      unsigned long head  = m_head.load(std::memory_order_acquire);
+      unsigned long n     = head - tail;
+
+      if (n > count) {
+        n = count;
+      }
+
+      for (unsigned long i=0; i < n; i++) {
+        data[i] = m_buffer[(tail + i) & m_mask];
+      }
+
+      m_tail.store(tail + n, std::memory_order_release);
+      return n;
+    };
+
+    /**
+     *  Consumer: copies the next item without removing it.
+     */
+    bool peek(T& item)
+    {
+      unsigned long tail = m_tail.load(std::memory_order_relaxed);
+
+      if (m_head.load(std::memory_order_acquire) == tail) {
+        return false;
+      }
+
+      item = m_buffer[tail & m_mask];
+      return true;
+    };
+
+    inline unsigned long getCapacity()    { return m_capacity; };
+    inline unsigned long getWriteCount()  { return m_head.load(std::memory_order_acquire); };
+    inline unsigned long getReadCount()   { return m_tail.load(std::memory_order_acquire); };
+
+  private:
+    RingBuffer(const RingBuffer&);
+    RingBuffer& operator=(const RingBuffer&);
+
+    T*                          m_buffer;
+    unsigned long               m_capacity;
+    unsigned long               m_mask;
+
+    // Keep the two positions on separate cache lines so the
+    // producer and consumer don't fight over them.  Padding
+    // rather than alignas, so ring buffers can live on the heap
+    char                        m_pad0[64];
+    std::atomic<unsigned long>  m_head;
+    char                        m_pad1[64];
+    std::atomic<unsigned long>  m_tail;
+    char                        m_pad2[64];
+};
+
+#endif /* defined(__rfswitch__RingBuffer__) */
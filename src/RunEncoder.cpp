@@ -0,0 +1,376 @@
+/**
+ *  @file   RunEncoder.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "RunEncoder.h"
+
+#include <climits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// Open runs are clamped here so hours of silence can't overflow
+#define MAX_PENDING (INT_MAX/2)
+
+/**
+ *  Each kernel returns the index of the first sample whose
+ *  binary value differs from ``level``, or ``n`` if every
+ *  sample matches.  A sample is a ``1`` if it is above
+ *  ``thresh``.  There is one kernel per sample type for each
+ *  instruction set.
+ */
+struct Kernels {
+  int (*f32)(const float* p, int n, float thresh, int level);
+  int (*s16)(const int16_t* p, int n, int16_t thresh, int level);
+  int (*s32)(const int32_t* p, int n, int32_t thresh, int level);
+};
+
+template <typename T>
+static int scan_scalar(const T* p, int n, T thresh, int level)
+{
+  for (int i=0; i < n; i++) {
+    if ((p[i] > thresh) != level) {
+      return i;
+    }
+  }
+  return n;
+};
+
+#if defined(__SSE2__)
+static int scan_sse2(const float* p, int n, float thresh, int level)
+{
+  __m128  t     = _mm_set1_ps(thresh);
+  int     want  = level ? 0xF : 0x0;
+  int     i     = 0;
+
+  for (; i+4 <= n; i += 4) {
+    int mask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(p+i), t));
+    if (mask != want) {
+      return i + __builtin_ctz(mask ^ want);
+    }
+  }
+
+  return i + scan_scalar(p+i, n-i, thresh, level);
+};
+
+static int scan_sse2(const int16_t* p, int n, int16_t thresh, int level)
+{
+  __m128i t     = _mm_set1_epi16(thresh);
+  int     want  = level ? 0xFFFF : 0x0;
+  int     i     = 0;
+
+  // Two compares packed to bytes give one mask bit per sample
+  for (; i+16 <= n; i += 16) {
+    __m128i c0    = _mm_cmpgt_epi16(_mm_loadu_si128((const __m128i*)(p+i)),   t);
+    __m128i c1    = _mm_cmpgt_epi16(_mm_loadu_si128((const __m128i*)(p+i+8)), t);
+    int     mask  = _mm_movemask_epi8(_mm_packs_epi16(c0, c1));
+    if (mask != want) {
+      return i + __builtin_ctz(mask ^ want);
+    }
+  }
+
+  return i + scan_scalar(p+i, n-i, thresh, level);
+};
+
+static int scan_sse2(const int32_t* p, int n, int32_t thresh, int level)
+{
+  __m128i t     = _mm_set1_epi32(thresh);
+  int     want  = level ? 0xF : 0x0;
+  int     i     = 0;
+
+  for (; i+4 <= n; i += 4) {
+    __m128i c     = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)(p+i)), t);
+    int     mask  = _mm_movemask_ps(_mm_castsi128_ps(c));
+    if (mask != want) {
+      return i + __builtin_ctz(mask ^ want);
+    }
+  }
+
+  return i + scan_scalar(p+i, n-i, thresh, level);
+};
+#endif
+
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+static int scan_avx2(const float* p, int n, float thresh, int level)
+{
+  __m256  t     = _mm256_set1_ps(thresh);
+  int     want  = level ? 0xFF : 0x00;
+  int     i     = 0;
+
+  // Silence is by far the common case, so test 32 samples at a time
+  for (; i+32 <= n; i += 32) {
+    int m0 = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p+i),    t, _CMP_GT_OQ));
+    int m1 = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p+i+8),  t, _CMP_GT_OQ));
+    int m2 = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p+i+16), t, _CMP_GT_OQ));
+    int m3 = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p+i+24), t, _CMP_GT_OQ));
+
+    unsigned mask = (unsigned)m0 | ((unsigned)m1 << 8) | ((unsigned)m2 << 16) | ((unsigned)m3 << 24);
+    unsigned diff = level ? ~mask : mask;
+    if (diff != 0) {
+      return i + __builtin_ctz(diff);
+    }
+  }
+
+  for (; i+8 <= n; i += 8) {
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p+i), t, _CMP_GT_OQ));
+    if (mask != want) {
+      return i + __builtin_ctz(mask ^ want);
+    }
+  }
+
+  return i + scan_scalar(p+i, n-i, thresh, level);
+};
+
+/**
+ *  Packs two 16-sample compares into one byte per sample, in
+ *  order (the pack works within 128-bit lanes, so the middle
+ *  quarters are swapped back).
+ */
+__attribute__((target("avx2")))
+static inline unsigned mask_avx2(const int16_t* p, __m256i t)
+{
+  __m256i c0 = _mm256_cmpgt_epi16(_mm256_loadu_si256((const __m256i*)p),      t);
+  __m256i c1 = _mm256_cmpgt_epi16(_mm256_loadu_si256((const __m256i*)(p+16)), t);
+  return (unsigned)_mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(c0, c1), 0xD8));
+};
+
+__attribute__((target("avx2")))
+static int scan_avx2(const int16_t* p, int n, int16_t thresh, int level)
+{
+  __m256i t = _mm256_set1_epi16(thresh);
+  int     i = 0;
+
+  // 64 samples per test, twice as many as for floats
+  for (; i+64 <= n; i += 64) {
+    unsigned long long mask = mask_avx2(p+i, t) | ((unsigned long long)mask_avx2(p+i+32, t) << 32);
+    unsigned long long diff = level ? ~mask : mask;
+    if (diff != 0) {
+      return i + __builtin_ctzll(diff);
+    }
+  }
+
+  for (; i+32 <= n; i += 32) {
+    unsigned mask = mask_avx2(p+i, t);
+    unsigned diff = level ? ~mask : mask;
+    if (diff != 0) {
+      return i + __builtin_ctz(diff);
+    }
+  }
+
+  return i + scan_scalar(p+i, n-i, thresh, level);
+};
+
+__attribute__((target("avx2")))
+static int scan_avx2(const int32_t* p, int n, int32_t thresh, int level)
+{
+  __m256i t     = _mm256_set1_epi32(thresh);
+  int     want  = level ? 0xFF : 0x00;
+  int     i     = 0;
+
+  for (; i+8 <= n; i += 8) {
+    __m256i c     = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(p+i)), t);
+    int     mask  = _mm256_movemask_ps(_mm256_castsi256_ps(c));
+    if (mask != want) {
+      return i + __builtin_ctz(mask ^ want);
+    }
+  }
+
+  return i + scan_scalar(p+i, n-i, thresh, level);
+};
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+static inline bool any_set(uint64x2_t c)
+{
+  return (vgetq_lane_u64(c, 0) | vgetq_lane_u64(c, 1)) != 0;
+};
+
+static int scan_neon(const float* p, int n, float thresh, int level)
+{
+  float32x4_t t = vdupq_n_f32(thresh);
+  int         i = 0;
+
+  for (; i+4 <= n; i += 4) {
+    uint32x4_t c = vcgtq_f32(vld1q_f32(p+i), t);
+    if (level) {
+      c = vmvnq_u32(c);
+    }
+
+    if (any_set(vreinterpretq_u64_u32(c))) {
+      return i + scan_scalar(p+i, 4, thresh, level);
+    }
+  }
+
+  return i + scan_scalar(p+i, n-i, thresh, level);
+};
+
+static int scan_neon(const int16_t* p, int n, int16_t thresh, int level)
+{
+  int16x8_t t = vdupq_n_s16(thresh);
+  int       i = 0;
+
+  for (; i+8 <= n; i += 8) {
+    uint16x8_t c = vcgtq_s16(vld1q_s16(p+i), t);
+    if (level) {
+      c = vmvnq_u16(c);
+    }
+
+    if (any_set(vreinterpretq_u64_u16(c))) {
+      return i + scan_scalar(p+i, 8, thresh, level);
+    }
+  }
+
+  return i + scan_scalar(p+i, n-i, thresh, level);
+};
+
+static int scan_neon(const int32_t* p, int n, int32_t thresh, int level)
+{
+  int32x4_t t = vdupq_n_s32(thresh);
+  int       i = 0;
+
+  for (; i+4 <= n; i += 4) {
+    uint32x4_t c = vcgtq_s32(vld1q_s32(p+i), t);
+    if (level) {
+      c = vmvnq_u32(c);
+    }
+
+    if (any_set(vreinterpretq_u64_u32(c))) {
+      return i + scan_scalar(p+i, 4, thresh, level);
+    }
+  }
+
+  return i + scan_scalar(p+i, n-i, thresh, level);
+};
+#endif
+
+static Kernels      g_scan        = {NULL, NULL, NULL};
+static const char*  g_scan_name   = NULL;
+
+static void select_kernel()
+{
+  g_scan.f32  = scan_scalar<float>;
+  g_scan.s16  = scan_scalar<int16_t>;
+  g_scan.s32  = scan_scalar<int32_t>;
+  g_scan_name = "scalar";
+
+#if defined(__SSE2__)
+  g_scan.f32  = scan_sse2;
+  g_scan.s16  = scan_sse2;
+  g_scan.s32  = scan_sse2;
+  g_scan_name = "sse2";
+#endif
+
+#ifdef HAVE_AVX2_KERNEL
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    g_scan.f32  = scan_avx2;
+    g_scan.s16  = scan_avx2;
+    g_scan.s32  = scan_avx2;
+    g_scan_name = "avx2";
+  }
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  g_scan.f32  = scan_neon;
+  g_scan.s16  = scan_neon;
+  g_scan.s32  = scan_neon;
+  g_scan_name = "neon";
+#endif
+};
+
+static inline int scan(const float* p, int n, float thresh, int level)
+{
+  return g_scan.f32(p, n, thresh, level);
+};
+
+static inline int scan(const int16_t* p, int n, int16_t thresh, int level)
+{
+  return g_scan.s16(p, n, thresh, level);
+};
+
+static inline int scan(const int32_t* p, int n, int32_t thresh, int level)
+{
+  return g_scan.s32(p, n, thresh, level);
+};
+
+const char* RunEncoder::getKernelName()
+{
+  if (g_scan_name == NULL) {
+    select_kernel();
+  }
+  return g_scan_name;
+};
+
+RunEncoder::RunEncoder(float threshold)
+: m_level(0), m_pending(0)
+{
+  m_thresholds[0] = threshold;
+  m_thresholds[1] = threshold;
+
+  if (g_scan_name == NULL) {
+    select_kernel();
+  }
+};
+
+void RunEncoder::reset()
+{
+  m_level   = 0;
+  m_pending = 0;
+};
+
+/**
+ *  Encodes ``length`` samples, writing every run that ends
+ *  within the buffer to ``runs`` (which must have room for
+ *  ``length`` entries).  Returns the number of runs written.
+ */
+template <typename T>
+int RunEncoder::encode(const T* buffer, int length, Run* runs)
+{
+  T   thresholds[2] = {SampleTraits<T>::threshold(m_thresholds[0]),
+                       SampleTraits<T>::threshold(m_thresholds[1])};
+  int count         = 0;
+  int i             = 0;
+
+  while (i < length)
+  {
+    int n = scan(buffer+i, length-i, thresholds[m_level], m_level);
+
+    m_pending += n;
+    if (m_pending > MAX_PENDING) {
+      m_pending = MAX_PENDING;
+    }
+    i += n;
+
+    if (i < length) {
+      // Level change: close off the current run (the very first
+      // run may be empty if the input starts high)
+      if (m_pending > 0) {
+        runs[count].level   = m_level;
+        runs[count].length  = m_pending;
+        count++;
+      }
+
+      m_level   ^= 1;
+      m_pending  = 0;
+    }
+  }
+
+  return count;
+};
+
+template int RunEncoder::encode<int16_t>(const int16_t* buffer, int length, Run* runs);
+template int RunEncoder::encode<int32_t>(const int32_t* buffer, int length, Run* runs);
+template int RunEncoder::encode<float>(const float* buffer, int length, Run* runs);
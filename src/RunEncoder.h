@@ -0,0 +1,60 @@
+/**
+ *  @file   RunEncoder.h
+ *  @class  RunEncoder
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Converts a buffer of analog samples into a list of
+ *  run-lengths of binary levels.  Rather than deciding
+ *  on every sample, the encoder scans forward for the
+ *  next sample that differs from the current level,
+ *  using SIMD compares where the CPU supports them
+ *  (SSE2/AVX2 on x86, NEON on ARM), so long stretches of
+ *  silence are skipped in a handful of instructions.
+ *
+ *  The run that is still open at the end of a buffer is
+ *  carried over into the next call to ``encode``.  A low
+ *  level ends when a sample rises above the rising threshold,
+ *  a high level when one falls to the falling threshold.
+ *
+ *  Samples may be int16, int32 or float.  Thresholds are set
+ *  as levels in [-1, 1] and converted to the sample type once
+ *  per buffer, so integer input is compared as it is (eight
+ *  int16 samples per SSE2 compare, rather than four floats).
+ *
+ */
+
+#ifndef __rfswitch__RunEncoder__
+#define __rfswitch__RunEncoder__
+
+#include "SampleType.h"
+
+struct Run {
+  int level;    // 1 or 0
+  int length;   // In samples
+};
+
+class RunEncoder {
+  public:
+    RunEncoder(float threshold);
+
+    template <typename T>
+    int         encode(const T* buffer, int length, Run* runs);
+    void        reset();
+
+    inline void setThresholds(float rising, float falling) {
+      m_thresholds[0] = rising;
+      m_thresholds[1] = falling;
+    };
+
+    inline int  getLevel()    { return m_level; };
+    inline int  getPending()  { return m_pending; };
+
+    static const char* getKernelName();
+
+  private:
+    float       m_thresholds[2];  // Indexed by the current level
+    int         m_level;
+    int         m_pending;
+};
+
+#endif /* defined(__rfswitch__RunEncoder__) */
@@ -0,0 +1,292 @@
+/**
+ *  @file   SampleReader.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  All multi-byte values are assumed to be little-endian,
+ *  which matches both WAV files and the hosts we run on.
+ *
+ */
+
+#include "SampleReader.h"
+#include "record.h"
+
+#include <climits>
+#include <cstring>
+#include <stdint.h>
+
+#define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_IEEE_FLOAT  0x0003
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
+
+SampleReader::SampleReader()
+: m_fh(NULL), m_encoding(SAMPLE_S16), m_channels(1), m_rate((int)SAMPLE_RATE),
+  m_frame_size(2), m_peek_len(0), m_peek_pos(0)
+{};
+
+SampleReader::~SampleReader()
+{
+  this->close();
+};
+
+bool SampleReader::parseFormat(const char* name, FORMAT& format)
+{
+  if (strcmp(name, "auto") == 0) {
+    format = FORMAT_AUTO;
+  } else if (strcmp(name, "wav") == 0) {
+    format = FORMAT_WAV;
+  } else if (strcmp(name, "f32") == 0) {
+    format = FORMAT_F32;
+  } else if (strcmp(name, "s16") == 0) {
+    format = FORMAT_S16;
+  } else {
+    return false;
+  }
+  return true;
+};
+
+RF_ERROR SampleReader::open(const char* path, FORMAT format, int raw_rate)
+{
+  this->close();
+
+  if (strcmp(path, "-") == 0) {
+    m_fh = stdin;
+  } else {
+    m_fh = fopen(path, "rb");
+  }
+
+  if (m_fh == NULL) {
+    return RFE_INPUT_OPEN;
+  }
+
+  // Peek at the start of the stream so we can tell a WAV
+  // header apart from raw samples, even on a pipe
+  m_peek_pos = 0;
+  m_peek_len = (int)fread(m_peek, 1, sizeof(m_peek), m_fh);
+
+  bool is_wav = (m_peek_len == 12 &&
+                 memcmp(m_peek, "RIFF", 4) == 0 &&
+                 memcmp(m_peek+8, "WAVE", 4) == 0);
+
+  if (format == FORMAT_WAV || (format == FORMAT_AUTO && is_wav)) {
+    if (!is_wav) {
+      return RFE_INPUT_FORMAT;
+    }
+    m_peek_pos = 12;
+    return this->read_wav_header();
+  }
+
+  // Raw samples carry no header, so the rate has to be given
+  m_channels    = 1;
+  m_rate        = raw_rate;
+  m_encoding    = (format == FORMAT_F32) ? SAMPLE_F32 : SAMPLE_S16;
+  m_frame_size  = (format == FORMAT_F32) ? 4 : 2;
+
+  return RFE_NO_ERROR;
+};
+
+RF_ERROR SampleReader::read_wav_header()
+{
+  unsigned char header[8];
+  unsigned char fmt[40];
+  bool          have_fmt = false;
+
+  while (this->read_bytes(header, 8) == 8)
+  {
+    uint32_t size = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+
+    if (memcmp(header, "data", 4) == 0) {
+      // Streamed WAVs (e.g. from arecord) carry a bogus data size,
+      // so we just read samples until EOF
+      return have_fmt ? RFE_NO_ERROR : RFE_INPUT_FORMAT;
+    }
+
+    if (memcmp(header, "fmt ", 4) == 0 && size >= 16 && size <= sizeof(fmt)) {
+      if (this->read_bytes(fmt, size) != size) {
+        return RFE_INPUT_FORMAT;
+      }
+
+      int       tag   = fmt[0] | (fmt[1] << 8);
+      int       bits  = fmt[14] | (fmt[15] << 8);
+      uint32_t  rate  = fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) | ((uint32_t)fmt[7] << 24);
+
+      // The same floor -r has; a bogus rate would decode at 0 Hz
+      if (rate < MIN_RATE || rate > INT_MAX) {
+        return RFE_INPUT_FORMAT;
+      }
+
+      m_channels  = fmt[2] | (fmt[3] << 8);
+      m_rate      = (int)rate;
+
+      if (tag == WAVE_FORMAT_EXTENSIBLE && size >= 26) {
+        // The real format tag is the start of the sub-format GUID
+        tag = fmt[24] | (fmt[25] << 8);
+      }
+
+      if (tag == WAVE_FORMAT_PCM && bits == 16) {
+        m_encoding = SAMPLE_S16;
+      } else if (tag == WAVE_FORMAT_PCM && bits == 32) {
+        m_encoding = SAMPLE_S32;
+      } else if (tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32) {
+        m_encoding = SAMPLE_F32;
+      } else {
+        return RFE_INPUT_FORMAT;
+      }
+
+      // Every channel gets a decoder and a block of its own
+      if (m_channels < 1 || m_channels > MAX_INPUT_CHANNELS) {
+        return RFE_INPUT_FORMAT;
+      }
+
+      m_frame_size  = m_channels * (bits / 8);
+      have_fmt      = true;
+
+      // Chunks are padded to an even size
+      if (size & 1) {
+        this->read_bytes(fmt, 1);
+      }
+    }
+
+    else {
+      // Skip chunks we don't care about
+      size += (size & 1);
+      while (size > 0) {
+        size_t n = (size > sizeof(m_block)) ? sizeof(m_block) : size;
+        if (this->read_bytes(m_block, n) != n) {
+          return RFE_INPUT_FORMAT;
+        }
+        size -= (uint32_t)n;
+      }
+    }
+  }
+
+  return RFE_INPUT_FORMAT;
+};
+
+size_t SampleReader::read_bytes(void* buffer, size_t size)
+{
+  unsigned char*  out   = (unsigned char*)buffer;
+  size_t          count = 0;
+
+  while (m_peek_pos < m_peek_len && count < size) {
+    out[count++] = m_peek[m_peek_pos++];
+  }
+
+  if (count < size) {
+    count += fread(out+count, 1, size-count, m_fh);
+  }
+
+  return count;
+};
+
+/**
+ *  Converts one sample stored as ``encoding`` at ``p`` to ``T``.
+ */
+template <typename T>
+static inline T convert(const unsigned char* p, SAMPLE_TYPE encoding)
+{
+  switch (encoding)
+  {
+    case SAMPLE_S16: {
+      int16_t v;
+      memcpy(&v, p, sizeof(v));
+      return SampleTraits<T>::fromLevel(SampleTraits<int16_t>::toLevel(v));
+    }
+    case SAMPLE_S32: {
+      int32_t v;
+      memcpy(&v, p, sizeof(v));
+      return SampleTraits<T>::fromLevel(SampleTraits<int32_t>::toLevel(v));
+    }
+    case SAMPLE_F32: {
+      float v;
+      memcpy(&v, p, sizeof(v));
+      return SampleTraits<T>::fromLevel(v);
+    }
+  }
+  return 0;
+};
+
+/**
+ *  Reads up to ``frames`` samples of the first channel into
+ *  ``buffer``.  Returns the number of samples read, or 0 once
+ *  the input is exhausted.
+ */
+template <typename T>
+int SampleReader::read(T* buffer, int frames)
+{
+  return this->read_samples(buffer, frames, 1);
+};
+
+/**
+ *  Reads up to ``frames`` frames of every channel into
+ *  ``buffer``, interleaved, so it must have room for
+ *  ``frames * getChannels()`` samples.  Returns the number
+ *  of frames read.
+ */
+template <typename T>
+int SampleReader::readFrames(T* buffer, int frames)
+{
+  return this->read_samples(buffer, frames, m_channels);
+};
+
+template <typename T>
+int SampleReader::read_samples(T* buffer, int frames, int channels)
+{
+  int   total   = 0;
+  int   width   = m_frame_size / m_channels;
+  bool  native  = (SampleTraits<T>::type == m_encoding);
+
+  if (m_fh == NULL) {
+    return 0;
+  }
+
+  if (native && channels == m_channels) {
+    // Samples are little-endian, as on every host we run on
+    return (int)(this->read_bytes(buffer, (size_t)frames * m_frame_size) / m_frame_size);
+  }
+
+  while (total < frames)
+  {
+    int want = frames - total;
+    if (want * m_frame_size > (int)sizeof(m_block)) {
+      want = (int)sizeof(m_block) / m_frame_size;
+    }
+
+    int got = (int)(this->read_bytes(m_block, want * m_frame_size) / m_frame_size);
+
+    for (int i=0; i < got; i++) {
+      for (int c=0; c < channels; c++) {
+        const unsigned char*  p   = m_block + i*m_frame_size + c*width;
+        T&                    out = buffer[(total+i)*channels + c];
+
+        if (native) {
+          memcpy(&out, p, sizeof(T));
+        } else {
+          out = convert<T>(p, m_encoding);
+        }
+      }
+    }
+
+    total += got;
+
+    if (got < want) {
+      break;
+    }
+  }
+
+  return total;
+};
+
+template int SampleReader::read<int16_t>(int16_t* buffer, int frames);
+template int SampleReader::read<int32_t>(int32_t* buffer, int frames);
+template int SampleReader::read<float>(float* buffer, int frames);
+template int SampleReader::readFrames<int16_t>(int16_t* buffer, int frames);
+template int SampleReader::readFrames<int32_t>(int32_t* buffer, int frames);
+template int SampleReader::readFrames<float>(float* buffer, int frames);
+
+void SampleReader::close()
+{
+  if (m_fh != NULL && m_fh != stdin) {
+    fclose(m_fh);
+  }
+  m_fh = NULL;
+};
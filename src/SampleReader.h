@@ -0,0 +1,67 @@
+/**
+ *  @file   SampleReader.h
+ *  @class  SampleReader
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Reads recorded receiver audio from a WAV file, a raw
+ *  PCM file or stdin (``-``) so it can be fed to the
+ *  Sampler without a live PortAudio device.  Samples can be
+ *  read as int16, int32 or float; when the type asked for is
+ *  the one the file holds, all channels are read straight
+ *  into the caller's buffer with no conversion.
+ *
+ */
+
+#ifndef __rfswitch__SampleReader__
+#define __rfswitch__SampleReader__
+
+#include "error.h"
+#include "SampleType.h"
+
+#include <cstdio>
+
+class SampleReader {
+  public:
+    enum FORMAT {
+      FORMAT_AUTO,        // WAV if the input starts with a RIFF header, else raw s16
+      FORMAT_WAV,
+      FORMAT_F32,         // Raw little-endian float32
+      FORMAT_S16          // Raw little-endian int16
+    };
+
+    SampleReader();
+    ~SampleReader();
+
+    RF_ERROR    open(const char* path, FORMAT format, int raw_rate);
+    template <typename T>
+    int         read(T* buffer, int frames);
+    template <typename T>
+    int         readFrames(T* buffer, int frames);
+    void        close();
+
+    inline int          getChannels()   { return m_channels; };
+    inline int          getRate()       { return m_rate; };
+    inline SAMPLE_TYPE  getSampleType() { return m_encoding; };
+
+    static bool parseFormat(const char* name, FORMAT& format);
+
+  private:
+    RF_ERROR    read_wav_header();
+    template <typename T>
+    int         read_samples(T* buffer, int frames, int channels);
+    size_t      read_bytes(void* buffer, size_t size);
+
+    FILE*         m_fh;
+    SAMPLE_TYPE   m_encoding;
+    int           m_channels;
+    int           m_rate;
+    int           m_frame_size;
+
+    unsigned char m_peek[12];
+    int           m_peek_len;
+    int           m_peek_pos;
+
+    unsigned char m_block[16384];
+};
+
+#endif /* defined(__rfswitch__SampleReader__) */
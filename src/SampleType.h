@@ -0,0 +1,91 @@
+/**
+ *  @file   SampleType.h
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  The sample types the decoder takes as they come from the
+ *  sound card or file, without converting them to float.
+ *  Levels (thresholds, noise floor, signal) are always kept
+ *  as floats in [-1, 1]; ``SampleTraits`` converts between
+ *  the two.
+ *
+ */
+
+#ifndef __rfswitch__SampleType__
+#define __rfswitch__SampleType__
+
+#include <stdint.h>
+
+enum SAMPLE_TYPE {
+  SAMPLE_S16,
+  SAMPLE_S32,
+  SAMPLE_F32
+};
+
+template <typename T> struct SampleTraits;
+
+template <> struct SampleTraits<int16_t> {
+  typedef int32_t Sum;    // Wide enough to add up a block of samples
+
+  static const SAMPLE_TYPE type = SAMPLE_S16;
+
+  static inline float toLevel(int16_t x) {
+    return x * (1.0f / 32768);
+  };
+
+  static inline int16_t fromLevel(float level) {
+    float x = level * 32768;
+    return (int16_t)(x >= 32767 ? 32767 : (x <= -32768 ? -32768 : x));
+  };
+
+  // The largest sample that is not above ``level``
+  static inline int16_t threshold(float level) {
+    float x = level * 32768;
+    if (x >= 32767) {
+      return 32767;
+    }
+    if (x < -32768) {
+      return -32768;
+    }
+    int16_t t = (int16_t)x;
+    return (t > x) ? t-1 : t;
+  };
+};
+
+template <> struct SampleTraits<int32_t> {
+  typedef int64_t Sum;
+
+  static const SAMPLE_TYPE type = SAMPLE_S32;
+
+  static inline float toLevel(int32_t x) {
+    return x * (1.0f / 2147483648.0f);
+  };
+
+  static inline int32_t fromLevel(float level) {
+    double x = level * 2147483648.0;
+    return (int32_t)(x >= 2147483647.0 ? 2147483647.0 : (x <= -2147483648.0 ? -2147483648.0 : x));
+  };
+
+  static inline int32_t threshold(float level) {
+    double x = level * 2147483648.0;
+    if (x >= 2147483647.0) {
+      return 2147483647;
+    }
+    if (x < -2147483648.0) {
+      return (int32_t)-2147483648LL;
+    }
+    int32_t t = (int32_t)x;
+    return (t > x) ? t-1 : t;
+  };
+};
+
+template <> struct SampleTraits<float> {
+  typedef float Sum;
+
+  static const SAMPLE_TYPE type = SAMPLE_F32;
+
+  static inline float toLevel(float x)        { return x; };
+  static inline float fromLevel(float level)  { return level; };
+  static inline float threshold(float level)  { return level; };
+};
+
+#endif /* defined(__rfswitch__SampleType__) */
@@ -3,146 +3,461 @@
  *  @author Weston Nielson <wnielson@github>
  *
  */
-#ifdef HAVE_PORTAUDIO_H
 #include "Sampler.h"
 #include "record.h"
 
+#include <cmath>
 #include <cstdio>
-#include <string>
+#include <cstring>
+#include <time.h>
 
 using namespace std;
 
-Sampler::Sampler()
-: m_code(NULL), m_zeroes(0), m_mode(MODE_COUNT_ZEROES)
-{};
+/**
+ *  Creates a decoder for input at ``rate``, decimated by the
+ *  largest whole factor that keeps it at or above
+ *  ``decode_rate``.
+ */
+Sampler::Sampler(double rate, double decode_rate)
+: m_decimator(Decimator::getFactor(rate, decode_rate)),
+  m_rate(rate / m_decimator.getFactor()), m_encoder(SIGNAL_THRESH), m_tracker(SIGNAL_THRESH), m_adaptive(true),
+  m_fixed(SIGNAL_THRESH), m_margin(CONFIDENCE_MARGIN),
+  m_precision(CONFIDENCE_PRECISION), m_matcher_count(0), m_candidate_count(0),
+  m_frame_count(0), m_position(0), m_found(false), m_verbose(true), m_frame_callback(NULL),
+  m_frame_arg(NULL)
+{
+  memset(&m_result, 0, sizeof(m_result));
+  memset(m_slots, -1, sizeof(m_slots));
+  m_matcher_count = create_matchers(m_matchers, MAX_MATCHERS, m_rate);
+  
+  for (int m=0; m < MAX_MATCHERS; m++) {
+    m_leaders[m].best   = -1;
+    m_leaders[m].second = 0;
+  }
+};
+
+/**
+ *  Uses ``threshold`` for every sample instead of adapting
+ *  to the input.
+ */
+void Sampler::setThreshold(float threshold)
+{
+  m_adaptive  = false;
+  m_fixed     = threshold;
+  m_encoder.setThresholds(threshold, threshold);
+};
+
+/**
+ *  Sets how far (in frames) a code must lead the others of its
+ *  protocol, and how precise (in percent) its mean timings must
+ *  be, before it is accepted early.  A margin of 0 waits for
+ *  CODE_COUNT frames.
+ */
+void Sampler::setConfidence(int margin, float precision)
+{
+  m_margin    = margin;
+  m_precision = precision;
+};
+
+Sampler::~Sampler()
+{
+  for (int i=0; i < m_matcher_count; i++) {
+    delete m_matchers[i];
+  }
+};
 
-bool Sampler::sample(float* buffer, int length)
-{  
-  for (int j=0; j < length; j++)
+/**
+ *  Decodes ``length`` samples and returns true if a code was
+ *  found in them (it is then in getResult()).  The whole buffer
+ *  is always consumed, so sampling can carry on afterwards.
+ */
+template <typename T>
+bool Sampler::sample(const T* buffer, int length)
+{
+  timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  
+  m_found = false;
+  
+  int factor    = m_decimator.getFactor();
+  T*  decimated = reinterpret_cast<T*>(&m_decimated);   // The union member of type T
+  
+  for (int offset=0; offset < length; )
   {
-    // Convert the analog signal into binary
-    int value = this->get_binary(buffer[j]);
+    const T*  samples = buffer + offset;
+    int       chunk   = length - offset;
     
-    // Keep track on consecutive zeroes
-    if (value == 1) {
-      m_zeroes = 0;
+    if (factor > 1) {
+      // With a partial block held back this still decimates to
+      // RUN_BUFFER_SIZE samples at most
+      if (chunk > RUN_BUFFER_SIZE * factor) {
+        chunk = RUN_BUFFER_SIZE * factor;
+      }
+      offset += chunk;
+      chunk   = m_decimator.process(samples, chunk, decimated);
+      samples = decimated;
     } else {
-      m_zeroes++;
+      if (chunk > RUN_BUFFER_SIZE) {
+        chunk = RUN_BUFFER_SIZE;
+      }
+      offset += chunk;
+    }
+    
+    if (chunk == 0) {
+      continue;
+    }
+    
+    if (m_adaptive) {
+      m_tracker.update(samples, chunk);
+      m_encoder.setThresholds(m_tracker.getRising(), m_tracker.getFalling());
     }
     
-    if (m_zeroes >= ZERO_PREAMBLE_THRESH)
-    {
-      m_mode = MODE_WAIT_HI;
-      if (m_code != NULL)
-      {
-        if (m_code->validate())
-        {
-          
-          fprintf(stdout, ".");
-          fflush(stdout);
-          
-          string code_str = m_code->getCodeString();
-          m_codes[code_str].push_back(m_code);
-          
-          for (code_list_map_it it = m_codes.begin(); it != m_codes.end(); it++)
-          {
-            int count = (int)(*it).second.size();
-            
-            if (count > CODE_COUNT) {
-              // We've found the code
-              printf("\nFound code\n");
-              printf("  code:     %s\n", code_str.c_str());
-              
-              if (this->process_codes((*it).second)) {
-                return true;
-              }
-              
-              printf("Error processing the code\n");
-              return false;
-            }
-          }
-          
-        } else {
-          // Invalid code
-          delete m_code;
-          m_code = NULL;
+    // Convert the analog signal into runs of 1s and 0s
+    int count = m_encoder.encode(samples, chunk, m_runs);
+    m_stats.runs += count;
+    
+    // Work back from the run still open to where the first run began
+    long position = m_position + chunk - m_encoder.getPending();
+    for (int j=0; j < count; j++) {
+      position -= m_runs[j].length;
+    }
+    
+    for (int j=0; j < count; j++) {
+      int finished = -1;
+      
+      position += m_runs[j].length;
+      for (int m=0; m < m_matcher_count; m++) {
+        if (!m_matchers[m]->addRun(m_runs[j].level, m_runs[j].length) ||
+            this->is_duplicate(m, finished)) {
+          continue;
+        }
+        if (finished < 0) {
+          finished = m;
+        }
+        if (this->add_frame(m, m_matchers[m]->getFrame(), position)) {
+          m_found = true;
         }
-        
       }
-      
-      m_zeroes = 0;
     }
     
-    if (m_mode == MODE_WAIT_HI) {
-      if (value == 1) {
-        m_mode = MODE_READ_CODE;
-        m_code = new Code;
-      }
+    m_position += chunk;
+  }
+  
+  // Let the matchers finish a frame whose final pulse is still open
+  int finished = -1;
+  for (int m=0; m < m_matcher_count; m++) {
+    if (!m_matchers[m]->addPending(m_encoder.getLevel(), m_encoder.getPending()) ||
+        this->is_duplicate(m, finished)) {
+      continue;
+    }
+    if (finished < 0) {
+      finished = m;
+    }
+    if (this->add_frame(m, m_matchers[m]->getFrame(), m_position)) {
+      m_found = true;
+    }
+  }
+  
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  m_stats.addBuffer((end.tv_sec - start.tv_sec)*1000000000LL + (end.tv_nsec - start.tv_nsec), length);
+  
+  return m_found;
+  
+};
+
+template bool Sampler::sample<int16_t>(const int16_t* buffer, int length);
+template bool Sampler::sample<int32_t>(const int32_t* buffer, int length);
+template bool Sampler::sample<float>(const float* buffer, int length);
+
+/**
+ *  Returns true if the frame ``matcher`` just finished is one
+ *  ``earlier`` finished on the same run, read as the same bits.
+ *  Where line codes overlap (24 bits that pair up into valid
+ *  tri-state symbols are both a PT2262 and an EV1527 frame)
+ *  the matcher listed first keeps the frame.
+ */
+bool Sampler::is_duplicate(int matcher, int earlier)
+{
+  return earlier >= 0 &&
+         strcmp(m_matchers[earlier]->getFrame().bits, m_matchers[matcher]->getFrame().bits) == 0;
+};
+
+bool Sampler::add_frame(int matcher, const Frame& frame, long position)
+{
+  m_frame_count++;
+  m_stats.frames++;
+  if (m_frame_callback != NULL) {
+    m_frame_callback(frame, position, m_frame_arg);
+  }
+  
+  // Progress stops once a code has been printed
+  if (m_verbose && !m_found) {
+    fprintf(stdout, ".");
+    fflush(stdout);
+  }
+  
+  uint64_t  key     = 0;
+  int       length  = 0;
+  
+  for (; frame.bits[length] != '\0'; length++) {
+    key = (key << 1) | (frame.bits[length] == '1');
+  }
+  
+  int         slot      = this->find_slot(key, length, matcher);
+  Candidate*  candidate = NULL;
+  
+  if (m_slots[slot] >= 0) {
+    candidate = &m_candidates[m_slots[slot]];
+  } else {
+    int evicted = -1;
+    
+    if (m_candidate_count < MAX_CANDIDATES) {
+      m_slots[slot] = m_candidate_count;
+      candidate     = &m_candidates[m_candidate_count++];
+    } else {
+      candidate = this->evict_candidate();
+      evicted   = candidate->matcher;
+      m_stats.evictions++;
     }
     
-    if (m_mode == MODE_READ_CODE) {
-      if (m_code == NULL) {
-        m_code = new Code;
+    candidate->key      = key;
+    candidate->length   = length;
+    candidate->matcher  = matcher;
+    candidate->protocol = frame.protocol;
+    strcpy(candidate->code, frame.code);
+    strcpy(candidate->bits, frame.bits);
+    memset(candidate->timings, 0, sizeof(candidate->timings));
+    memset(candidate->squares, 0, sizeof(candidate->squares));
+    candidate->count = 0;
+    
+    if (evicted >= 0) {
+      // The old key may sit anywhere in a probe chain, so rebuild
+      this->index_candidates();
+      this->rank_matcher(evicted);
+    }
+  }
+  
+  for (int i=0; i < 4; i++) {
+    candidate->timings[i] += frame.timings[i];
+    candidate->squares[i] += (double)frame.timings[i] * frame.timings[i];
+  }
+  candidate->count++;
+  candidate->seen = m_frame_count;
+  this->rank_candidate((int)(candidate - m_candidates));
+  
+  if (candidate->count > CODE_COUNT || this->is_confident(*candidate)) {
+    // We've found the code
+    if (m_verbose) {
+      printf("\nFound code\n");
+      if (strcmp(candidate->protocol, "legacy") != 0) {
+        printf("  protocol: %s\n", candidate->protocol);
+        printf("  symbols:  %s\n", candidate->code);
       }
-      m_code->addValue(value);
+      printf("  code:     %s\n", candidate->bits);
     }
     
+    bool ok = this->process_codes(*candidate);
+    
+    // Start counting afresh should sampling continue
+    memset(candidate->timings, 0, sizeof(candidate->timings));
+    memset(candidate->squares, 0, sizeof(candidate->squares));
+    candidate->count = 0;
+    this->rank_matcher(candidate->matcher);
+    
+    if (ok) {
+      m_stats.codes++;
+      return true;
+    }
+    
+    if (m_verbose) {
+      printf("Error processing the code\n");
+    }
   }
   
   return false;
+};
+
+/**
+ *  Returns true if ``candidate`` is far enough ahead of every
+ *  other code of its protocol, and its timings agree closely
+ *  enough, to be accepted without waiting for CODE_COUNT frames.
+ */
+bool Sampler::is_confident(const Candidate& candidate)
+{
+  int count = candidate.count;
+  
+  // Codes that haven't been seen yet count as zero frames
+  if (m_margin <= 0 || count < CONFIDENCE_MIN_FRAMES || count < m_margin) {
+    return false;
+  }
+  
+  const Leader& leader = m_leaders[candidate.matcher];
+  
+  if (&m_candidates[leader.best] != &candidate || count - leader.second < m_margin) {
+    return false;
+  }
   
+  for (int i=0; i < 4; i++) {
+    double mean     = (double)candidate.timings[i] / count;
+    double variance = candidate.squares[i] / count - mean * mean;
+    
+    // Standard error of the mean, relative to the mean
+    if (mean <= 0 ||
+        sqrt((variance > 0 ? variance : 0) / (count - 1)) > mean * m_precision / 100) {
+      return false;
+    }
+  }
+  
+  return true;
 };
 
-void Sampler::rewind()
+/**
+ *  Returns the slot holding the given code, or the empty slot
+ *  where it belongs.
+ */
+int Sampler::find_slot(uint64_t key, int length, int matcher)
 {
-  if (m_code != NULL) {
-    delete m_code;
-    m_code = NULL;
+  uint64_t  hash  = (key ^ ((uint64_t)length << 56) ^ ((uint64_t)matcher << 48)) *
+                    0x9E3779B97F4A7C15ULL;
+  int       slot  = (int)(hash >> (64 - CANDIDATE_HASH_BITS));
+  
+  // The table is never more than half full, so this ends
+  while (m_slots[slot] >= 0) {
+    const Candidate& candidate = m_candidates[m_slots[slot]];
+    if (candidate.key == key && candidate.length == length && candidate.matcher == matcher) {
+      break;
+    }
+    slot = (slot + 1) & (CANDIDATE_SLOTS - 1);
   }
+  
+  return slot;
 };
 
-int Sampler::get_binary(float value)
+void Sampler::index_candidates()
 {
-  // Convert analog signal to digital
-  if (value <= SIGNAL_THRESH) {
-    value = 0;
-    //zeroes++;
-  } else {
-    value  = 1;
-    //zeroes = 0;
+  memset(m_slots, -1, sizeof(m_slots));
+  
+  for (int i=0; i < m_candidate_count; i++) {
+    const Candidate& candidate = m_candidates[i];
+    m_slots[this->find_slot(candidate.key, candidate.length, candidate.matcher)] = i;
+  }
+};
+
+/**
+ *  Updates the leaders of a candidate's matcher after its count
+ *  went up.  Counts only ever grow between calls to
+ *  rank_matcher, so no other candidate needs to be looked at.
+ */
+void Sampler::rank_candidate(int index)
+{
+  const Candidate&  candidate = m_candidates[index];
+  Leader&           leader    = m_leaders[candidate.matcher];
+  
+  if (leader.best == index) {
+    return;
   }
   
-  return value;
+  if (leader.best < 0 || candidate.count > m_candidates[leader.best].count) {
+    leader.second = (leader.best < 0) ? 0 : m_candidates[leader.best].count;
+    leader.best   = index;
+  } else if (candidate.count > leader.second) {
+    leader.second = candidate.count;
+  }
 };
 
+/**
+ *  Works out a matcher's leaders from scratch, for when a count
+ *  has gone down.
+ */
+void Sampler::rank_matcher(int matcher)
+{
+  Leader& leader = m_leaders[matcher];
+  
+  leader.best   = -1;
+  leader.second = 0;
+  
+  for (int i=0; i < m_candidate_count; i++) {
+    if (m_candidates[i].matcher == matcher) {
+      this->rank_candidate(i);
+    }
+  }
+};
 
-bool Sampler::process_codes(list<Code*>& codes)
+/**
+ *  Returns the candidate with the fewest frames, for reuse.  Of
+ *  those, the one seen longest ago goes, so a code that has only
+ *  just arrived isn't pushed straight out again by noise.
+ */
+Sampler::Candidate* Sampler::evict_candidate()
 {
-  int lo_long   = 0,
-      lo_short  = 0,
-      hi_long   = 0,
-      hi_short  = 0,
-      size      = (int)codes.size();
+  Candidate* weakest = &m_candidates[0];
   
-  for (list<Code*>::iterator it=codes.begin(); it != codes.end(); it++)
-  {
-    lo_long   += (*it)->getLength(0);
-    hi_long   += (*it)->getLength(1);
-    lo_short  += (*it)->getLength(2);
-    hi_short  += (*it)->getLength(3);
+  for (int i=1; i < m_candidate_count; i++) {
+    if (m_candidates[i].count < weakest->count ||
+        (m_candidates[i].count == weakest->count && m_candidates[i].seen < weakest->seen)) {
+      weakest = &m_candidates[i];
+    }
+  }
+  
+  return weakest;
+};
+
+void Sampler::rewind()
+{
+  m_stats.rewinds++;
+  
+  // Samples are missing, so no frame in progress can be trusted
+  for (int m=0; m < m_matcher_count; m++) {
+    m_matchers[m]->reset();
   }
+  m_encoder.reset();
+  m_decimator.reset();
+};
+
+/**
+ *  Returns the decoder's counters, with the matchers' reject
+ *  counts gathered up.
+ */
+const DecodeStats& Sampler::getStats()
+{
+  m_stats.candidates = m_candidate_count;
   
-  hi_long   /=  size;
-  hi_short  /=  size;
-  lo_long   /=  size;
-  lo_short  /=  size;
+  for (int r=0; r < REJECT_COUNT; r++) {
+    m_stats.rejects[r] = 0;
+    for (int m=0; m < m_matcher_count; m++) {
+      m_stats.rejects[r] += m_matchers[m]->getRejects(r);
+    }
+  }
   
-  printf("  hi-long:  %d\n  hi-short: %d\n", hi_long, hi_short);
-  printf("  lo-long:  %d\n  lo-short: %d\n", lo_long, lo_short);
-  printf("  timings:  %d,%d,%d,%d\n", (int)(hi_short/(float)SAMPLE_RATE*1e9), (int)(lo_long/(float)SAMPLE_RATE*1e9),
-                                      (int)(hi_long/(float)SAMPLE_RATE*1e9), (int)(lo_short/(float)SAMPLE_RATE*1e9));
+  return m_stats;
+};
 
+bool Sampler::process_codes(Candidate& candidate)
+{
+  int size      = candidate.count,
+      hi_short  = (int)(candidate.timings[0] / size),
+      lo_long   = (int)(candidate.timings[1] / size),
+      hi_long   = (int)(candidate.timings[2] / size),
+      lo_short  = (int)(candidate.timings[3] / size);
+  
+  m_result.protocol = candidate.protocol;
+  strcpy(m_result.symbols, candidate.code);
+  strcpy(m_result.code, candidate.bits);
+  m_result.timings[0] = (int)(hi_short/m_rate*1e9);
+  m_result.timings[1] = (int)(lo_long/m_rate*1e9);
+  m_result.timings[2] = (int)(hi_long/m_rate*1e9);
+  m_result.timings[3] = (int)(lo_short/m_rate*1e9);
+  m_result.frames     = size;
+  m_result.threshold  = this->getThreshold();
+  m_result.snr        = this->getSNR();
+  
+  if (m_verbose) {
+    printf("  hi-long:  %d\n  hi-short: %d\n", hi_long, hi_short);
+    printf("  lo-long:  %d\n  lo-short: %d\n", lo_long, lo_short);
+    printf("  timings:  %d,%d,%d,%d\n", m_result.timings[0], m_result.timings[1],
+                                        m_result.timings[2], m_result.timings[3]);
+    printf("  frames:   %d\n", size);
+  }
+  
   return true;
 };
-
-#endif
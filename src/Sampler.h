@@ -5,46 +5,154 @@
  *
  *  This class contains the functionality for parsing
  *  a stream of RF data and finding occurrences of repeating
- *  switch control codes.
+ *  switch control codes.  The samples are run-length
+ *  encoded once and every known protocol's matcher is fed
+ *  the same runs.  Unless a fixed threshold is set, the 1/0
+ *  threshold follows the input's noise floor and signal
+ *  level.  Input well above the decode rate is decimated
+ *  first, so the decoder's cost follows the decode rate
+ *  rather than the input's.  Samples are taken as int16,
+ *  int32 or float, as the input delivers them.
  *
  */
 
 #ifndef __rfswitch__Sampler__
 #define __rfswitch__Sampler__
 
-#include <portaudio.h>
 #include "Code.h"
+#include "DecodeStats.h"
+#include "Decimator.h"
+#include "LevelTracker.h"
+#include "Protocol.h"
+#include "RunEncoder.h"
+#include "record.h"
 
-#include <map>
-#include <list>
-#include <string>
+#include <stdint.h>
 
 using namespace std;
 
-typedef map<string, list<Code*> >           code_list_map;
-typedef map<string, list<Code*> >::iterator code_list_map_it;
+// Samples are run-length encoded in chunks of this size
+#define RUN_BUFFER_SIZE (1024)
+
+// Distinct codes tracked at once; the weakest is evicted when full
+#define MAX_CANDIDATES  (16)
+
+// Candidates are found through an open-addressed table of
+// 2^CANDIDATE_HASH_BITS slots, kept at most half full
+#define CANDIDATE_HASH_BITS (5)
+#define CANDIDATE_SLOTS     (1<<CANDIDATE_HASH_BITS)
+
+// Called with every frame that decodes and the stream position (in
+// samples at the decode rate since the Sampler was created) at
+// which it was completed
+typedef void (*FrameCallback)(const Frame& frame, long position, void* arg);
 
 class Sampler {
   public:
-    Sampler();
-    bool  sample(float* buffer, int length);
+    Sampler(double rate = SAMPLE_RATE, double decode_rate = DECODE_RATE);
+    ~Sampler();
+    template <typename T>
+    bool  sample(const T* buffer, int length);
     void  rewind();
-  
-    enum  MODE {
-      MODE_COUNT_ZEROES,  // Count zeroes until ZERO_PREAMBLE_THRESH is reached
-      MODE_WAIT_HI,       // Once ZERO_PREAMBLE_THRESH is reached, this will wait for a `1`
-      MODE_READ_CODE
+    
+    inline void setVerbose(bool verbose)  { m_verbose = verbose; };
+    void        setThreshold(float threshold);
+    void        setConfidence(int margin, float precision);
+    inline void setFrameCallback(FrameCallback callback, void* arg) {
+      m_frame_callback  = callback;
+      m_frame_arg       = arg;
+    };
+    
+    // Frames of one code, with their timings (and squares) summed.
+    // A code is identified by its bits packed into ``key``, its
+    // length and the matcher that decoded it.
+    struct Candidate {
+      uint64_t    key;
+      int         length;
+      int         matcher;
+      const char* protocol;
+      char        code[MAX_CODE_BITS+1];
+      char        bits[MAX_CODE_BITS+1];
+      long        timings[4];
+      double      squares[4];
+      int         count;
+      long        seen;     // Frame number of the latest frame
     };
+    
+    // The code that was found, with its timings in ns
+    struct Result {
+      const char* protocol;
+      char        symbols[MAX_CODE_BITS+1];
+      char        code[MAX_CODE_BITS+1];
+      int         timings[4];   // short-hi, long-lo, long-hi, short-lo, in ns
+      int         frames;       // Frames of the code that were averaged
+      float       threshold;
+      float       snr;          // dB, or 0 if unknown
+    };
+    
+    inline const Result&  getResult()     { return m_result; };
+    inline long           getFrameCount() { return m_frame_count; };
+    inline long           getPosition()   { return m_position; };
+    inline double         getRate()       { return m_rate; };
+    inline double         getInputRate()  { return m_rate * m_decimator.getFactor(); };
+    const DecodeStats&    getStats();
+    inline float          getThreshold()  { return m_adaptive ? m_tracker.getThreshold() : m_fixed; };
+    inline float          getSNR()        { return m_tracker.getSNR(); };
   
   private:
-    int   get_binary(float value);
-    bool  process_codes(list<Code*>& codes);
-
-    int             m_zeroes;
-    Sampler::MODE   m_mode;
-  
-    Code*           m_code;
-    code_list_map   m_codes;
+    Sampler(const Sampler&);
+    Sampler& operator=(const Sampler&);
+    
+    // The two highest frame counts among one matcher's candidates
+    struct Leader {
+      int         best;     // Candidate index, or -1
+      int         second;   // Count of the runner-up
+    };
+    
+    bool        is_duplicate(int matcher, int earlier);
+    bool        add_frame(int matcher, const Frame& frame, long position);
+    bool        process_codes(Candidate& candidate);
+    bool        is_confident(const Candidate& candidate);
+    
+    int         find_slot(uint64_t key, int length, int matcher);
+    Candidate*  evict_candidate();
+    void        index_candidates();
+    void        rank_candidate(int index);
+    void        rank_matcher(int matcher);
+    
+    Decimator       m_decimator;
+    double          m_rate;                     // After decimation
+    
+    // Decimated samples, of whichever type is being decoded
+    union {
+      int16_t       s16[RUN_BUFFER_SIZE];
+      int32_t       s32[RUN_BUFFER_SIZE];
+      float         f32[RUN_BUFFER_SIZE];
+    }               m_decimated;
+    RunEncoder      m_encoder;
+    LevelTracker    m_tracker;
+    bool            m_adaptive;
+    float           m_fixed;
+    int             m_margin;
+    float           m_precision;
+    Run             m_runs[RUN_BUFFER_SIZE];
+    
+    Matcher*        m_matchers[MAX_MATCHERS];
+    int             m_matcher_count;
+    
+    Candidate       m_candidates[MAX_CANDIDATES];
+    int             m_candidate_count;
+    int8_t          m_slots[CANDIDATE_SLOTS];   // Candidate index, or -1
+    Leader          m_leaders[MAX_MATCHERS];
+    
+    Result          m_result;
+    long            m_frame_count;
+    long            m_position;
+    DecodeStats     m_stats;
+    bool            m_found;
+    bool            m_verbose;
+    FrameCallback   m_frame_callback;
+    void*           m_frame_arg;
 };
 
 #endif /* defined(__rfswitch__Sampler__) */
@@ -0,0 +1,128 @@
+/**
+ *  @file   Sniffer.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "Sniffer.h"
+
+#include <cstring>
+#include <time.h>
+
+Sniffer::Sniffer(Sampler& sampler, const char* source, EventWriter& writer,
+                 FORMAT format, int merge_ms)
+: m_sampler(sampler), m_writer(writer), m_format(format),
+  m_window((long)(merge_ms * sampler.getRate() / 1000)), m_active(false), m_protocol(NULL),
+  m_frames(0), m_first(0), m_last(0), m_events(0)
+{
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  m_epoch = ts.tv_sec + ts.tv_nsec/1e9 - sampler.getPosition() / sampler.getRate();
+
+  strncpy(m_source, source, sizeof(m_source)-1);
+  m_source[sizeof(m_source)-1] = 0;
+
+  m_sampler.setVerbose(false);
+  m_sampler.setFrameCallback(Sniffer::on_frame, this);
+};
+
+bool Sniffer::parseFormat(const char* name, FORMAT& format)
+{
+  if (strcmp(name, "json") == 0) {
+    format = FORMAT_JSON;
+  } else if (strcmp(name, "kv") == 0) {
+    format = FORMAT_KV;
+  } else {
+    return false;
+  }
+  return true;
+};
+
+void Sniffer::on_frame(const Frame& frame, long position, void* arg)
+{
+  ((Sniffer*)arg)->add_frame(frame, position);
+};
+
+void Sniffer::add_frame(const Frame& frame, long position)
+{
+  // Another protocol's reading of the frame that was just added;
+  // matchers run most specific first, so the first reading stands
+  if (m_active && m_protocol != frame.protocol && position == m_last) {
+    return;
+  }
+
+  bool repeat = m_active && m_protocol == frame.protocol &&
+                strcmp(m_bits, frame.bits) == 0 && position - m_last <= m_window;
+
+  if (!repeat) {
+    if (m_active) {
+      this->emit();
+    }
+
+    m_active    = true;
+    m_protocol  = frame.protocol;
+    m_frames    = 0;
+    m_first     = position;
+    strcpy(m_code, frame.code);
+    strcpy(m_bits, frame.bits);
+    memset(m_timings, 0, sizeof(m_timings));
+  }
+
+  for (int i=0; i < 4; i++) {
+    m_timings[i] += frame.timings[i];
+  }
+  m_frames++;
+  m_last = position;
+};
+
+/**
+ *  Writes out the event in progress if no repeat has arrived
+ *  within the merge window.  Call after every batch.
+ */
+void Sniffer::flush()
+{
+  if (m_active && m_sampler.getPosition() - m_last > m_window) {
+    this->emit();
+  }
+};
+
+void Sniffer::finish()
+{
+  if (m_active) {
+    this->emit();
+  }
+};
+
+void Sniffer::emit()
+{
+  char    line[EVENT_LINE_SIZE];
+  int     timings[4];
+  double  rate      = m_sampler.getRate();
+  double  time      = m_epoch + m_first / rate;
+  double  duration  = (m_last - m_first) * 1000 / rate;
+
+  for (int i=0; i < 4; i++) {
+    timings[i] = (int)(m_timings[i] / (double)m_frames / rate * 1e9);
+  }
+
+  if (m_format == FORMAT_JSON) {
+    snprintf(line, sizeof(line),
+             "{\"time\":%.3f,\"source\":\"%s\",\"protocol\":\"%s\",\"code\":\"%s\","
+             "\"symbols\":\"%s\",\"timings\":[%d,%d,%d,%d],\"repeats\":%d,"
+             "\"duration_ms\":%.0f,\"threshold\":%.4f,\"snr\":%.1f}\n",
+             time, m_source, m_protocol, m_bits, m_code,
+             timings[0], timings[1], timings[2], timings[3], m_frames, duration,
+             m_sampler.getThreshold(), m_sampler.getSNR());
+  } else {
+    snprintf(line, sizeof(line),
+             "time=%.3f source=%s protocol=%s code=%s symbols=%s timings=%d,%d,%d,%d "
+             "repeats=%d duration_ms=%.0f threshold=%.4f snr=%.1f\n",
+             time, m_source, m_protocol, m_bits, m_code,
+             timings[0], timings[1], timings[2], timings[3], m_frames, duration,
+             m_sampler.getThreshold(), m_sampler.getSNR());
+  }
+
+  m_writer.write(line);
+  m_active = false;
+  m_events++;
+};
@@ -0,0 +1,69 @@
+/**
+ *  @file   Sniffer.h
+ *  @class  Sniffer
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Turns the frames one Sampler decodes into events: the
+ *  repeats of a code sent by one press of a button are
+ *  merged, and the event is written as a single line once
+ *  no repeat has arrived for a while.  Only the event in
+ *  progress is kept, so memory use doesn't grow however long
+ *  the sniffer runs.
+ *
+ */
+
+#ifndef __rfswitch__Sniffer__
+#define __rfswitch__Sniffer__
+
+#include "EventWriter.h"
+#include "Sampler.h"
+
+// Repeats of a code less than this far apart belong to one event
+#define SNIFF_MERGE_MS    (250)
+
+class Sniffer {
+  public:
+    enum FORMAT {
+      FORMAT_JSON,    // One JSON object per line
+      FORMAT_KV       // key=value pairs
+    };
+
+    Sniffer(Sampler& sampler, const char* source, EventWriter& writer,
+            FORMAT format, int merge_ms);
+
+    void        flush();
+    void        finish();
+
+    inline long getEventCount() { return m_events; };
+
+    static bool parseFormat(const char* name, FORMAT& format);
+
+  private:
+    Sniffer(const Sniffer&);
+    Sniffer& operator=(const Sniffer&);
+
+    static void on_frame(const Frame& frame, long position, void* arg);
+    void        add_frame(const Frame& frame, long position);
+    void        emit();
+
+    Sampler&        m_sampler;
+    char            m_source[SOURCE_LABEL_SIZE];
+    EventWriter&    m_writer;
+    FORMAT          m_format;
+    long            m_window;   // In samples
+    double          m_epoch;    // Wall-clock time of sample 0
+
+    // The event in progress
+    bool            m_active;
+    const char*     m_protocol;
+    char            m_code[MAX_CODE_BITS+1];
+    char            m_bits[MAX_CODE_BITS+1];
+    long            m_timings[4];
+    int             m_frames;
+    long            m_first;
+    long            m_last;
+
+    long            m_events;
+};
+
+#endif /* defined(__rfswitch__Sniffer__) */
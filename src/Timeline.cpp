@@ -0,0 +1,118 @@
+/**
+ *  @file   Timeline.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "Timeline.h"
+
+#include <cerrno>
+#include <cstring>
+
+#define NS_PER_SEC  (1000000000LL)
+
+Timeline::Timeline()
+: m_end(0), m_frames(0)
+{};
+
+void Timeline::reset()
+{
+  m_edges.clear();
+  m_end     = 0;
+  m_frames  = 0;
+};
+
+void Timeline::addPulse(int level, int64_t length, int symbol)
+{
+  Edge edge;
+
+  edge.time   = m_end;
+  edge.level  = level;
+  edge.symbol = symbol;
+
+  m_edges.push_back(edge);
+  m_end += length;
+};
+
+/**
+ *  Appends a single frame of ``code``.  The values are the
+ *  config timings: short-hi, long-lo, long-hi, short-lo and
+ *  the delay after the frame.
+ */
+void Timeline::addFrame(const char* code, const int values[5])
+{
+  for (const char* c = code; *c; c++)
+  {
+    if (*c == '1') {
+      // Send long-hi and short-lo
+      this->addPulse(1, values[2], SYMBOL_LONG_HI);
+      this->addPulse(0, values[3], SYMBOL_SHORT_LO);
+    } else {
+      // Send short-hi and long-lo
+      this->addPulse(1, values[0], SYMBOL_SHORT_HI);
+      this->addPulse(0, values[1], SYMBOL_LONG_LO);
+    }
+  }
+
+  // The last low pulse runs on into the delay
+  if (!m_edges.empty() && *code) {
+    m_edges.back().symbol = SYMBOL_GAP;
+  }
+
+  m_end += values[4];
+  m_frames++;
+};
+
+const char* Timeline::getSymbolName(int symbol)
+{
+  static const char* names[SYMBOL_COUNT] = {
+    "short-hi", "long-lo", "long-hi", "short-lo", "lo+delay"
+  };
+
+  return (symbol >= 0 && symbol < SYMBOL_COUNT) ? names[symbol] : "?";
+};
+
+void Timeline::addCode(const char* code, const int values[5], int repeats)
+{
+  m_edges.reserve(m_edges.size() + 2*strlen(code)*repeats);
+
+  for (int r = 0; r < repeats; r++) {
+    this->addFrame(code, values);
+  }
+};
+
+void Timeline::now(timespec& ts)
+{
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+};
+
+static inline int64_t to_ns(const timespec& ts)
+{
+  return ts.tv_sec*NS_PER_SEC + ts.tv_nsec;
+};
+
+/**
+ *  Waits until ``offset`` ns after ``start``.  We sleep until
+ *  shortly before the deadline and spin for the remainder,
+ *  which hides the scheduler's wake-up latency.
+ */
+void Timeline::waitUntil(const timespec& start, int64_t offset)
+{
+  int64_t   deadline  = to_ns(start) + offset;
+  int64_t   coarse    = deadline - TIMELINE_SPIN_NS;
+  timespec  ts;
+
+  Timeline::now(ts);
+
+  if (to_ns(ts) < coarse) {
+    timespec wake;
+    wake.tv_sec   = coarse / NS_PER_SEC;
+    wake.tv_nsec  = coarse % NS_PER_SEC;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+  }
+
+  do {
+    Timeline::now(ts);
+  } while (to_ns(ts) < deadline);
+};
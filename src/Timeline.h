@@ -0,0 +1,69 @@
+/**
+ *  @file   Timeline.h
+ *  @class  Timeline
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  A precomputed transmit plan.  Every pulse of every
+ *  repeat is compiled up front into a list of edges, each
+ *  stamped with its time from the start of transmission,
+ *  so playback can wait for absolute deadlines and timing
+ *  errors never accumulate from one pulse to the next.
+ *
+ */
+
+#ifndef __rfswitch__Timeline__
+#define __rfswitch__Timeline__
+
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+
+// How long before each deadline to stop sleeping and start spinning
+#define TIMELINE_SPIN_NS  (50000)
+
+// The config timing each pulse was built from; the final low
+// pulse of a frame also includes the delay after it
+enum SYMBOL {
+  SYMBOL_SHORT_HI = 0,
+  SYMBOL_LONG_LO  = 1,
+  SYMBOL_LONG_HI  = 2,
+  SYMBOL_SHORT_LO = 3,
+  SYMBOL_GAP      = 4,
+  SYMBOL_COUNT
+};
+
+struct Edge {
+  int64_t time;   // ns from the start of transmission
+  int     level;  // 1 (set) or 0 (clear)
+  int     symbol; // SYMBOL of the pulse this edge starts
+};
+
+class Timeline {
+  public:
+    Timeline();
+
+    void            reset();
+    void            addFrame(const char* code, const int values[5]);
+    void            addCode(const char* code, const int values[5], int repeats);
+
+    inline int          getSize()     { return (int)m_edges.size(); };
+    inline const Edge&  getEdge(int i){ return m_edges[i]; };
+    inline int64_t      getDuration() { return m_end; };
+    inline int          getFrames()   { return m_frames; };
+
+    static const char*  getSymbolName(int symbol);
+
+    static void     now(timespec& ts);
+    static void     waitUntil(const timespec& start, int64_t offset);
+
+  private:
+    void            addPulse(int level, int64_t length, int symbol);
+
+    vector<Edge>    m_edges;
+    int64_t         m_end;
+    int             m_frames;
+};
+
+#endif /* defined(__rfswitch__Timeline__) */
@@ -0,0 +1,139 @@
+/**
+ *  @file   TimingTrace.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "TimingTrace.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+TimingTrace::TimingTrace()
+: m_timeline(NULL), m_start(0)
+{};
+
+void TimingTrace::prepare(Timeline& timeline)
+{
+  m_timeline = &timeline;
+
+  // assign() writes every slot, which also faults the pages in
+  m_actual.assign(timeline.getSize(), 0);
+};
+
+void TimingTrace::start(const timespec& start)
+{
+  m_start = start.tv_sec*1000000000LL + start.tv_nsec;
+};
+
+static int64_t percentile(vector<int64_t>& values, double p)
+{
+  size_t index = (size_t)(p * (values.size()-1));
+  nth_element(values.begin(), values.begin()+index, values.end());
+  return values[index];
+};
+
+/**
+ *  Prints, for each kind of pulse, how far its actual length
+ *  was from the planned length, then a histogram of those
+ *  errors and the lateness of each edge against its deadline.
+ */
+void TimingTrace::report(FILE* fh)
+{
+  int                 size = (int)m_actual.size();
+  vector<int64_t>     errors[SYMBOL_COUNT];
+  vector<int64_t>     lateness;
+  long                histogram[TRACE_BUCKETS] = {0};
+
+  if (m_timeline == NULL || size < 2) {
+    return;
+  }
+
+  for (int i = 0; i < size; i++)
+  {
+    const Edge& edge = m_timeline->getEdge(i);
+
+    lateness.push_back(m_actual[i] - m_start - edge.time);
+
+    if (i+1 < size) {
+      int64_t planned = m_timeline->getEdge(i+1).time - edge.time;
+      int64_t actual  = m_actual[i+1] - m_actual[i];
+      int64_t error   = actual - planned;
+
+      errors[edge.symbol].push_back(error);
+
+      int bucket = 0;
+      for (int64_t limit = 1000; bucket < TRACE_BUCKETS-1 && llabs(error) >= limit; limit <<= 1) {
+        bucket++;
+      }
+      histogram[bucket]++;
+    }
+  }
+
+  fprintf(fh, "Timing trace: %d edges\n", size);
+  fprintf(fh, "  %-10s %7s %10s %10s %10s %10s  (ns)\n", "pulse", "count", "min", "mean", "p99", "max");
+
+  for (int s = 0; s <= SYMBOL_COUNT; s++)
+  {
+    vector<int64_t>& values = (s < SYMBOL_COUNT) ? errors[s] : lateness;
+    if (values.empty()) {
+      continue;
+    }
+
+    int64_t sum = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+      sum += values[i];
+    }
+
+    int64_t lo = *min_element(values.begin(), values.end());
+    int64_t hi = *max_element(values.begin(), values.end());
+
+    fprintf(fh, "  %-10s %7d %10lld %10lld %10lld %10lld\n",
+            (s < SYMBOL_COUNT) ? Timeline::getSymbolName(s) : "lateness",
+            (int)values.size(), (long long)lo, (long long)(sum / (int64_t)values.size()),
+            (long long)percentile(values, 0.99), (long long)hi);
+  }
+
+  long most = *max_element(histogram, histogram+TRACE_BUCKETS);
+
+  fprintf(fh, "  |pulse error| histogram:\n");
+  for (int b = 0; b < TRACE_BUCKETS; b++)
+  {
+    char label[32];
+    if (b < TRACE_BUCKETS-1) {
+      snprintf(label, sizeof(label), "< %d us", 1 << b);
+    } else {
+      snprintf(label, sizeof(label), ">= %d us", 1 << (b-1));
+    }
+
+    int width = most ? (int)(40 * histogram[b] / most) : 0;
+    fprintf(fh, "  %10s %6ld %.*s\n", label, histogram[b], width,
+            "########################################");
+  }
+};
+
+/**
+ *  Writes ``<index> <level> <symbol> <planned ns> <actual ns>``
+ *  for every edge, times relative to the start of transmission.
+ */
+bool TimingTrace::dump(const char* path)
+{
+  FILE* fh = fopen(path, "w");
+
+  if (fh == NULL || m_timeline == NULL) {
+    if (fh != NULL) {
+      fclose(fh);
+    }
+    return false;
+  }
+
+  fprintf(fh, "# index level symbol planned_ns actual_ns\n");
+  for (int i = 0; i < (int)m_actual.size(); i++) {
+    const Edge& edge = m_timeline->getEdge(i);
+    fprintf(fh, "%d %d %s %lld %lld\n", i, edge.level, Timeline::getSymbolName(edge.symbol),
+            (long long)edge.time, (long long)(m_actual[i] - m_start));
+  }
+
+  fclose(fh);
+  return true;
+};
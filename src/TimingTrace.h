@@ -0,0 +1,48 @@
+/**
+ *  @file   TimingTrace.h
+ *  @class  TimingTrace
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Records when each edge of a timeline actually left the
+ *  pin and compares it with the plan.  All storage is
+ *  allocated and touched before transmission starts, so
+ *  recording costs one clock read per edge.
+ *
+ */
+
+#ifndef __rfswitch__TimingTrace__
+#define __rfswitch__TimingTrace__
+
+#include "Timeline.h"
+
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+// Histogram buckets: <1us, <2us, <4us ... and everything above
+#define TRACE_BUCKETS (14)
+
+class TimingTrace {
+  public:
+    TimingTrace();
+
+    void        prepare(Timeline& timeline);
+    void        start(const timespec& start);
+    void        report(FILE* fh);
+    bool        dump(const char* path);
+
+    inline void record(int i) {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      m_actual[i] = ts.tv_sec*1000000000LL + ts.tv_nsec;
+    };
+
+  private:
+    Timeline*       m_timeline;
+    int64_t         m_start;
+    vector<int64_t> m_actual;
+};
+
+#endif /* defined(__rfswitch__TimingTrace__) */
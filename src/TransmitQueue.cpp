@@ -0,0 +1,293 @@
+/**
+ *  @file   TransmitQueue.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "TransmitQueue.h"
+#include "switch.h"
+#include "Timeline.h"
+
+#include <cstring>
+
+static int64_t now_ns()
+{
+  timespec ts;
+  Timeline::now(ts);
+  return ts.tv_sec*1000000000LL + ts.tv_nsec;
+};
+
+/**
+ *  Whether ``a`` should go on the air before ``b``.  Jobs
+ *  without a deadline come after every job with one.
+ */
+static bool goes_before(const TransmitJob* a, const TransmitJob* b)
+{
+  if (a->priority != b->priority) {
+    return a->priority > b->priority;
+  }
+  if (a->deadline != b->deadline) {
+    if (a->deadline == 0 || b->deadline == 0) {
+      return b->deadline == 0;
+    }
+    return a->deadline < b->deadline;
+  }
+  return a->order < b->order;
+};
+
+TransmitJob::TransmitJob(Timeline* timeline, int id, int action, int64_t received)
+: timeline(timeline), id(id), action(action), priority(0), deadline(0),
+  received(received), order(0), state(JOB_QUEUED), started(0), first(0), airtime(0)
+{};
+
+TransmitQueue::TransmitQueue(Gpio& gpio)
+: m_gpio(gpio), m_playing(NULL), m_cancel(false), m_order(0), m_stop(false)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+};
+
+TransmitQueue::~TransmitQueue()
+{
+  this->stop();
+};
+
+void TransmitQueue::start()
+{
+  m_stop        = false;
+  m_stats.since = now_ns();
+  m_thread      = std::thread(&TransmitQueue::run, this);
+};
+
+/**
+ *  Cancels everything still queued, cuts the burst on the air
+ *  short and ends the thread.
+ */
+void TransmitQueue::stop()
+{
+  if (!m_thread.joinable()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    int64_t now = now_ns();
+
+    m_stop    = true;
+    m_cancel  = true;
+    for (size_t i=0; i < m_pending.size(); i++) {
+      this->settle(*m_pending[i], JOB_CANCELLED, now);
+    }
+    m_pending.clear();
+  }
+  m_ready.notify_one();
+  m_done.notify_all();
+  m_thread.join();
+};
+
+/**
+ *  Queues ``job`` and waits until it has been sent, or
+ *  settled some other way; ``job.state`` says which.
+ */
+void TransmitQueue::submit(TransmitJob& job)
+{
+  std::unique_lock<std::mutex> lock(m_lock);
+  int64_t now = now_ns();
+
+  job.state = JOB_QUEUED;
+  job.order = m_order++;
+
+  if (m_stop) {
+    this->settle(job, JOB_CANCELLED, now);
+    return;
+  }
+
+  if (job.id >= 0)
+  {
+    // A newer command replaces a queued one and takes its place
+    for (size_t i=0; i < m_pending.size(); i++) {
+      TransmitJob* old = m_pending[i];
+      if (old->id != job.id) {
+        continue;
+      }
+
+      job.order = old->order;
+      if (old->priority > job.priority) {
+        job.priority = old->priority;
+      }
+      if (old->deadline != 0 && (job.deadline == 0 || old->deadline < job.deadline)) {
+        job.deadline = old->deadline;
+      }
+
+      m_pending.erase(m_pending.begin() + i);
+      this->settle(*old, JOB_SUPERSEDED, now);
+      m_stats.superseded++;
+      break;
+    }
+
+    if (m_playing != NULL && m_playing->id == job.id)
+    {
+      if (m_playing->action == job.action && !m_cancel) {
+        m_merged.push_back(&job);
+        while (job.state == JOB_QUEUED) {
+          m_done.wait(lock);
+        }
+        return;
+      }
+
+      // The burst on the air is already out of date
+      m_cancel = true;
+    }
+  }
+
+  m_pending.push_back(&job);
+  m_ready.notify_one();
+
+  while (job.state == JOB_QUEUED || job.state == JOB_PLAYING)
+  {
+    if (job.state == JOB_PLAYING || job.deadline == 0) {
+      m_done.wait(lock);
+      continue;
+    }
+
+    // Give up as soon as the deadline passes, not when the
+    // transmitter next comes free
+    now = now_ns();
+    if (now < job.deadline) {
+      m_done.wait_for(lock, std::chrono::nanoseconds(job.deadline - now));
+    } else {
+      for (size_t i=0; i < m_pending.size(); i++) {
+        if (m_pending[i] == &job) {
+          m_pending.erase(m_pending.begin() + i);
+          this->settle(job, JOB_EXPIRED, now);
+          break;
+        }
+      }
+    }
+  }
+};
+
+TransmitStats TransmitQueue::getStats()
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_stats;
+};
+
+/**
+ *  Must be called with the lock held; waiters are woken by
+ *  whoever releases it.
+ */
+void TransmitQueue::settle(TransmitJob& job, int state, int64_t now)
+{
+  job.state = state;
+  if (job.started == 0) {
+    job.started = now;
+  }
+  if (state == JOB_EXPIRED) {
+    m_stats.expired++;
+  }
+  m_done.notify_all();
+};
+
+/**
+ *  Removes and returns the job to send next, settling any
+ *  whose deadline has passed on the way.  Called with the
+ *  lock held.
+ */
+TransmitJob* TransmitQueue::take(int64_t now)
+{
+  int best = -1;
+
+  for (size_t i=0; i < m_pending.size(); ) {
+    TransmitJob* job = m_pending[i];
+
+    if (job->deadline != 0 && job->deadline < now) {
+      m_pending.erase(m_pending.begin() + i);
+      this->settle(*job, JOB_EXPIRED, now);
+      continue;
+    }
+
+    if (best < 0 || goes_before(job, m_pending[best])) {
+      best = (int)i;
+    }
+    i++;
+  }
+
+  if (best < 0) {
+    return NULL;
+  }
+
+  TransmitJob* job = m_pending[best];
+  m_pending.erase(m_pending.begin() + best);
+  return job;
+};
+
+void TransmitQueue::run()
+{
+  for (;;)
+  {
+    TransmitJob* job;
+
+    {
+      std::unique_lock<std::mutex> lock(m_lock);
+
+      while (m_pending.empty() && !m_stop) {
+        m_ready.wait(lock);
+      }
+      if (m_stop) {
+        return;
+      }
+
+      job = this->take(now_ns());
+      if (job == NULL) {
+        continue;
+      }
+
+      job->state  = JOB_PLAYING;
+      m_playing   = job;
+      m_cancel    = false;
+    }
+
+    // Other rfswitch processes may be on the air too
+    int fd = lock_transmitter();
+
+    bool cut_short;
+    job->started  = now_ns();
+    job->airtime  = play_timeline(*job->timeline, m_gpio, &job->first, NULL, &m_cancel,
+                                  &cut_short);
+
+    unlock_transmitter(fd);
+
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      int64_t now     = now_ns();
+      int64_t queued  = job->started - job->received;
+      int     riders  = (int)m_merged.size();
+      int     state   = JOB_SENT;
+
+      // A cancel that came during the last frame changed nothing
+      if (cut_short) {
+        state = m_stop ? JOB_CANCELLED : JOB_SUPERSEDED;
+      }
+
+      if (state == JOB_SENT) {
+        m_stats.sent++;
+        m_stats.merged  += riders;
+        m_stats.queued  += queued;
+        if (queued > m_stats.max_queued) {
+          m_stats.max_queued = queued;
+        }
+      } else if (state == JOB_SUPERSEDED) {
+        m_stats.superseded += 1 + riders;
+      }
+      m_stats.airtime += job->airtime;
+
+      for (size_t i=0; i < m_merged.size(); i++) {
+        this->settle(*m_merged[i], state == JOB_SENT ? JOB_MERGED : state, now);
+      }
+      m_merged.clear();
+
+      this->settle(*job, state, now);
+      m_playing = NULL;
+    }
+  }
+};
@@ -0,0 +1,106 @@
+/**
+ *  @file   TransmitQueue.h
+ *  @class  TransmitQueue
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  The one place the daemon puts anything on the air.  Client
+ *  threads submit jobs and wait; a single thread plays them
+ *  one at a time, highest priority first, then earliest
+ *  deadline, then in order of arrival.
+ *
+ *  Commands for the same switch are coalesced: a queued job
+ *  is replaced outright by a newer one (which keeps its place
+ *  in line), a job repeating the action being played joins
+ *  it, and one reversing it cuts the burst short at the next
+ *  frame boundary.  Scenes are never coalesced.
+ *
+ */
+
+#ifndef __rfswitch__TransmitQueue__
+#define __rfswitch__TransmitQueue__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+class Gpio;
+class Timeline;
+
+enum JOB_STATE {
+  JOB_QUEUED,
+  JOB_PLAYING,
+  JOB_SENT,
+  JOB_SUPERSEDED, // Replaced by a newer command before it (fully) went out
+  JOB_MERGED,     // Joined a burst of the same command already on air
+  JOB_EXPIRED,    // Still queued at its deadline
+  JOB_CANCELLED   // The queue was stopped
+};
+
+struct TransmitJob {
+  TransmitJob(Timeline* timeline, int id, int action, int64_t received);
+
+  Timeline* timeline;
+  int       id;         // Switch id, or -1 for a scene
+  int       action;
+  int       priority;   // Higher goes first
+  int64_t   deadline;   // Monotonic ns to start by, or 0
+  int64_t   received;   // Monotonic ns the request arrived
+
+  // Filled in by the queue
+  long      order;
+  int       state;
+  int64_t   started;    // When it took the transmitter (or was settled)
+  int64_t   first;      // When its first edge went out
+  int64_t   airtime;    // How long it was actually on the air
+};
+
+struct TransmitStats {
+  long      sent;
+  long      superseded;
+  long      merged;
+  long      expired;
+  int64_t   airtime;    // Total ns on the air
+  int64_t   queued;     // Total ns sent jobs waited
+  int64_t   max_queued;
+  int64_t   since;      // When the queue started
+};
+
+class TransmitQueue {
+  public:
+    TransmitQueue(Gpio& gpio);
+    ~TransmitQueue();
+
+    void          start();
+    void          stop();
+    void          submit(TransmitJob& job);
+
+    TransmitStats getStats();
+
+  private:
+    TransmitQueue(const TransmitQueue&);
+    TransmitQueue& operator=(const TransmitQueue&);
+
+    void          run();
+    TransmitJob*  take(int64_t now);
+    void          settle(TransmitJob& job, int state, int64_t now);
+
+    Gpio&                     m_gpio;
+    std::vector<TransmitJob*> m_pending;
+    std::vector<TransmitJob*> m_merged;   // Riding on m_playing
+    TransmitJob*              m_playing;
+    std::atomic<bool>         m_cancel;   // Cut m_playing short
+    long                      m_order;
+    bool                      m_stop;
+    TransmitStats             m_stats;
+
+    std::mutex                m_lock;
+    std::condition_variable   m_ready;    // A job was queued
+    std::condition_variable   m_done;     // A job was settled
+    std::thread               m_thread;
+};
+
+#endif /* defined(__rfswitch__TransmitQueue__) */
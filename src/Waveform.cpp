@@ -0,0 +1,74 @@
+/**
+ *  @file   Waveform.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "Waveform.h"
+
+#include <cmath>
+
+#define NS_PER_SEC  (1e9)
+
+Waveform::Waveform(double rate)
+: m_rate(rate), m_amplitude(0.5f), m_offset(0.0f), m_noise(0.0f), m_jitter(0),
+  m_random(1), m_normal(0.0f, 1.0f)
+{};
+
+float Waveform::sample(int level)
+{
+  float value = m_offset + (level ? m_amplitude : 0.0f);
+
+  if (m_noise > 0) {
+    value += m_noise * m_normal(m_random);
+  }
+
+  return value;
+};
+
+/**
+ *  Appends ``length`` ns of an idle (low) signal.
+ */
+void Waveform::silence(int64_t length, vector<float>& samples)
+{
+  long count = lround(length * m_rate / NS_PER_SEC);
+
+  for (long i=0; i < count; i++) {
+    samples.push_back(this->sample(0));
+  }
+};
+
+/**
+ *  Appends the whole timeline, ending with the delay after
+ *  its last frame.  Each edge is moved by its own jitter,
+ *  but never before the edge that precedes it.
+ */
+void Waveform::render(Timeline& timeline, vector<float>& samples)
+{
+  size_t  base  = samples.size();
+  int     size  = timeline.getSize();
+  double  last  = 0;
+
+  samples.reserve(base + (size_t)(timeline.getDuration() * m_rate / NS_PER_SEC) + 1);
+
+  for (int i=0; i < size; i++)
+  {
+    const Edge& edge  = timeline.getEdge(i);
+    double      end   = (i+1 < size) ? (double)timeline.getEdge(i+1).time
+                                     : (double)timeline.getDuration();
+
+    if (m_jitter > 0 && i+1 < size) {
+      end += m_jitter * m_normal(m_random);
+    }
+    if (end < last) {
+      end = last;
+    }
+
+    size_t stop = base + (size_t)llround(end * m_rate / NS_PER_SEC);
+    while (samples.size() < stop) {
+      samples.push_back(this->sample(edge.level));
+    }
+
+    last = end;
+  }
+};
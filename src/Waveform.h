@@ -0,0 +1,54 @@
+/**
+ *  @file   Waveform.h
+ *  @class  Waveform
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  Renders a transmit Timeline into the sampled signal a
+ *  receiver would record, so the decoder can be exercised
+ *  without a transmitter.  Amplitude, DC offset, additive
+ *  gaussian noise and per-edge timing jitter can be set to
+ *  mimic a real capture.  The same seed always renders the
+ *  same samples.
+ *
+ */
+
+#ifndef __rfswitch__Waveform__
+#define __rfswitch__Waveform__
+
+#include "Timeline.h"
+
+#include <random>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+class Waveform {
+  public:
+    Waveform(double rate);
+
+    inline void setAmplitude(float amplitude) { m_amplitude = amplitude; };
+    inline void setOffset(float offset)       { m_offset = offset; };
+    inline void setNoise(float noise)         { m_noise = noise; };
+    inline void setJitter(int64_t jitter)     { m_jitter = jitter; };
+    inline void setSeed(unsigned seed)        { m_random.seed(seed); };
+
+    inline double getRate()                   { return m_rate; };
+
+    void        silence(int64_t length, vector<float>& samples);
+    void        render(Timeline& timeline, vector<float>& samples);
+
+  private:
+    float       sample(int level);
+
+    double      m_rate;
+    float       m_amplitude;  // Level of a high pulse above the offset
+    float       m_offset;     // DC offset added to every sample
+    float       m_noise;      // Standard deviation of the added noise
+    int64_t     m_jitter;     // Standard deviation of each edge's time, ns
+
+    mt19937                   m_random;
+    normal_distribution<float> m_normal;
+};
+
+#endif /* defined(__rfswitch__Waveform__) */
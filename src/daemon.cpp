@@ -0,0 +1,544 @@
+/**
+ *  @file   daemon.cpp
+ *  @author Weston Nielson <wnielson@github>
+ *
+ */
+
+#include "daemon.h"
+#include "switch.h"
+#include "CodeCache.h"
+#include "Gpio.h"
+#include "Timeline.h"
+#include "TransmitQueue.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <map>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+// Both actions of a code, compiled once at startup
+struct DaemonCode {
+  Timeline timelines[2];
+};
+
+struct DaemonState {
+  map<int, DaemonCode>    codes;
+  map<string, Timeline>   scenes;
+};
+
+struct Client {
+  int                 fd;
+  std::thread         thread;
+  std::atomic<bool>   done;
+};
+
+static volatile sig_atomic_t STOP = 0;
+
+static void catch_stop(int signal) {
+  STOP = 1;
+};
+
+static int64_t now_ns() {
+  timespec ts;
+  Timeline::now(ts);
+  return ts.tv_sec*1000000000LL + ts.tv_nsec;
+};
+
+static bool make_address(const char* path, sockaddr_un& addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  strcpy(addr.sun_path, path);
+  
+  return true;
+};
+
+static void reply(int fd, const char* text) {
+  size_t len = strlen(text);
+  while (len > 0) {
+    ssize_t n = write(fd, text, len);
+    if (n <= 0) {
+      break;
+    }
+    text  += n;
+    len   -= n;
+  }
+};
+
+static void reply_error(int fd, RF_ERROR error) {
+  char line[DAEMON_LINE_SIZE];
+  snprintf(line, sizeof(line), "error %d %s\n", (int)error, get_error_msg(error));
+  reply(fd, line);
+};
+
+static const char* STATE_NAMES[] = {
+  "queued", "playing", "sent", "superseded", "merged", "expired", "cancelled"
+};
+
+/**
+ *  Reads the optional ``priority=<n>`` and ``deadline=<ms>``
+ *  arguments that may follow a command.
+ */
+static bool parse_options(const char* args, TransmitJob& job) {
+  char  token[32];
+  int   value;
+  int   n;
+  
+  while (sscanf(args, "%31s%n", token, &n) == 1) {
+    if (sscanf(token, "priority=%d", &value) == 1) {
+      job.priority = value;
+    } else if (sscanf(token, "deadline=%d", &value) == 1 && value > 0) {
+      job.deadline = job.received + value*1000000LL;
+    } else {
+      return false;
+    }
+    args += n;
+  }
+  
+  return true;
+};
+
+static void reply_stats(int fd, TransmitQueue& queue) {
+  char          out[DAEMON_LINE_SIZE];
+  TransmitStats stats   = queue.getStats();
+  int64_t       uptime  = now_ns() - stats.since;
+  
+  snprintf(out, sizeof(out), "ok sent=%ld superseded=%ld merged=%ld expired=%ld "
+           "airtime=%lld busy=%.4f queued_mean=%lld queued_max=%lld ceiling=%.2f\n",
+           stats.sent, stats.superseded, stats.merged, stats.expired,
+           (long long)stats.airtime, uptime > 0 ? stats.airtime / (double)uptime : 0,
+           (long long)(stats.sent ? stats.queued / stats.sent : 0),
+           (long long)stats.max_queued,
+           stats.airtime > 0 ? stats.sent / (stats.airtime / 1e9) : 0);
+  reply(fd, out);
+};
+
+/**
+ *  Handles a single command line.  ``received`` is when the
+ *  line arrived, so the reported latency covers everything up
+ *  to the first edge leaving the pin, including the time
+ *  spent queued behind other commands.
+ */
+static void handle_command(int fd, char* line, int64_t received,
+                           DaemonState& state, TransmitQueue& queue) {
+  char      command[32];
+  char      action[32];
+  char      name[64];
+  int       id;
+  int       a   = -1;
+  int       n   = 0;
+  char      out[DAEMON_LINE_SIZE];
+  Timeline* timeline = NULL;
+  
+  if (sscanf(line, "%31s", command) != 1) {
+    reply_error(fd, RFE_INVALID_ARGS);
+    return;
+  }
+  
+  if (strcmp(command, "ping") == 0) {
+    reply(fd, "ok\n");
+    return;
+  }
+  
+  if (strcmp(command, "stats") == 0) {
+    reply_stats(fd, queue);
+    return;
+  }
+  
+  if (strcmp(command, "scene") == 0)
+  {
+    if (sscanf(line, "%*s %63s%n", name, &n) != 1) {
+      reply_error(fd, RFE_INVALID_ARGS);
+      return;
+    }
+    
+    map<string, Timeline>::iterator it = state.scenes.find(name);
+    if (it == state.scenes.end()) {
+      reply_error(fd, RFE_INVALID_ID);
+      return;
+    }
+    
+    timeline = &it->second;
+    snprintf(action, sizeof(action), "-");
+    id = -1;
+  }
+  
+  else
+  {
+    if (strcmp(command, "switch") != 0 ||
+        sscanf(line, "%*s %d %31s%n", &id, action, &n) != 2) {
+      reply_error(fd, RFE_INVALID_ARGS);
+      return;
+    }
+    
+    a = get_action(action);
+    if (a < 0) {
+      reply_error(fd, RFE_INVALID_ARGS);
+      return;
+    }
+    
+    map<int, DaemonCode>::iterator it = state.codes.find(id);
+    if (it == state.codes.end()) {
+      reply_error(fd, RFE_INVALID_ID);
+      return;
+    }
+    
+    timeline = &it->second.timelines[a];
+  }
+  
+  TransmitJob job(timeline, id, a, received);
+  
+  if (!parse_options(line+n, job)) {
+    reply_error(fd, RFE_INVALID_ARGS);
+    return;
+  }
+  
+  queue.submit(job);
+  
+  int64_t queued  = job.started - received;
+  int64_t latency = job.first - received;
+  
+  switch (job.state)
+  {
+    case JOB_SENT:
+      snprintf(out, sizeof(out), "ok latency=%lld queued=%lld airtime=%lld\n",
+               (long long)latency, (long long)queued, (long long)job.airtime);
+      reply(fd, out);
+      break;
+    case JOB_SUPERSEDED:
+    case JOB_MERGED:
+      snprintf(out, sizeof(out), "ok %s queued=%lld airtime=%lld\n", STATE_NAMES[job.state],
+               (long long)queued, (long long)job.airtime);
+      reply(fd, out);
+      break;
+    case JOB_EXPIRED:
+      reply_error(fd, RFE_DEADLINE);
+      break;
+    default:
+      reply_error(fd, RFE_DAEMON_STOPPING);
+      break;
+  }
+  
+  if (id < 0) {
+    printf("scene %s: %s, queued %lld ns, airtime %lld ns\n", name,
+           STATE_NAMES[job.state], (long long)queued, (long long)job.airtime);
+  } else {
+    printf("switch %d %s: %s, queued %lld ns, airtime %lld ns\n", id, action,
+           STATE_NAMES[job.state], (long long)queued, (long long)job.airtime);
+  }
+  fflush(stdout);
+};
+
+/**
+ *  Reads newline-terminated commands from a client until it
+ *  disconnects.  Each client has a thread of its own, which
+ *  waits in the queue while its commands are on the air.
+ */
+static void serve_client(Client* client, DaemonState& state, TransmitQueue& queue) {
+  char  buffer[DAEMON_LINE_SIZE];
+  int   used  = 0;
+  int   fd    = client->fd;
+  
+  // Shutting down closes the socket, which ends the loop
+  for (;;)
+  {
+    ssize_t n = read(fd, buffer+used, sizeof(buffer)-1-used);
+    if (n <= 0) {
+      break;
+    }
+    
+    int64_t received = now_ns();
+    used += (int)n;
+    buffer[used] = 0;
+    
+    char* start = buffer;
+    char* end;
+    while ((end = strchr(start, '\n')) != NULL) {
+      *end = 0;
+      handle_command(fd, start, received, state, queue);
+      start = end+1;
+    }
+    
+    // Keep any partial line for the next read
+    used -= (int)(start - buffer);
+    memmove(buffer, start, used);
+    
+    if (used == (int)sizeof(buffer)-1) {
+      reply_error(fd, RFE_INVALID_ARGS);
+      break;
+    }
+  }
+  
+  client->done = true;
+};
+
+/**
+ *  Joins and closes the clients that have disconnected, or
+ *  every client if ``all`` is set.
+ */
+static void reap_clients(list<Client*>& clients, bool all) {
+  list<Client*>::iterator it = clients.begin();
+  
+  while (it != clients.end()) {
+    Client* client = *it;
+    
+    if (!all && !client->done) {
+      it++;
+      continue;
+    }
+    
+    if (!client->done) {
+      shutdown(client->fd, SHUT_RDWR);
+    }
+    client->thread.join();
+    close(client->fd);
+    delete client;
+    it = clients.erase(it);
+  }
+};
+
+/**
+ *  Threads started while these are blocked leave SIGINT and
+ *  SIGTERM to the accept loop, which they have to interrupt.
+ */
+static void block_stop_signals(sigset_t& old) {
+  sigset_t stop;
+  
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop, &old);
+};
+
+int run_daemon(int argc, char **argv) {
+  string  config,
+          backend = "auto",
+          path;
+  int     pin     = GPIO_DEFAULT_PIN;
+  int     c;
+  
+  while ((c = getopt(argc, argv, "hc:g:p:S:")) != -1)
+  {
+    switch (c)
+    {
+      case 'h':
+        return RFE_SHOW_HELP;
+      case 'c':
+        config = optarg;
+        break;
+      case 'g':
+        backend = optarg;
+        break;
+      case 'p':
+        if (!Gpio::parsePin(optarg, pin)) {
+          return RFE_INVALID_ARGS;
+        }
+        break;
+      case 'S':
+        path = optarg;
+        break;
+      default:
+        return RFE_INVALID_ARGS;
+    }
+  }
+  
+  int rc = find_config(config);
+  if (rc != RFE_NO_ERROR) {
+    return rc;
+  }
+  
+  list<CodeData>  parsed;
+  list<SceneData> scenes;
+  DaemonState     state;
+  
+  // Take the compiled cache when it is current, as ``rfswitch s``
+  // does, and only parse the text without one
+  CodeCache cache;
+  bool      cached = cache.open(CodeCache::getPath(config), config) &&
+                     cache.load(parsed, &scenes);
+  cache.close();
+  
+  if (!cached) {
+    parsed.clear();
+    scenes.clear();
+    
+    // Serving part of a broken config would silently drop switches;
+    // load_codes has already said which line is wrong
+    if (load_codes(config.c_str(), parsed, &scenes) < 0) {
+      return RFE_INVALID_CONFIG;
+    }
+  }
+  
+  for (list<CodeData>::iterator it = parsed.begin(); it != parsed.end(); it++) {
+    DaemonCode& dc = state.codes[(*it).id];
+    for (int a = 0; a < 2; a++) {
+      compile_code(*it, a, dc.timelines[a]);
+    }
+  }
+  
+  for (list<SceneData>::iterator it = scenes.begin(); it != scenes.end(); it++) {
+    if (compile_scene(*it, parsed, state.scenes[(*it).name]) != RFE_NO_ERROR) {
+      printf("Ignoring scene %s: unknown switch id\n", (*it).name.c_str());
+      state.scenes.erase((*it).name);
+    }
+  }
+  
+  Gpio* gpio = Gpio::create(backend.c_str());
+  if (gpio == NULL) {
+    return RFE_INVALID_ARGS;
+  }
+  
+  rc = gpio->open(pin);
+  if (rc != RFE_NO_ERROR) {
+    delete gpio;
+    return rc;
+  }
+  
+  if (path.empty()) {
+    path = get_run_path(DAEMON_SOCKET);
+  }
+  if (path.empty()) {
+    printf("No safe place for the socket in %s or $XDG_RUNTIME_DIR; use -S\n", RUN_DIR);
+    delete gpio;
+    return RFE_DAEMON_SOCKET;
+  }
+  
+  sockaddr_un addr;
+  int         server = socket(AF_UNIX, SOCK_STREAM, 0);
+  
+  if (server < 0 || !make_address(path.c_str(), addr)) {
+    delete gpio;
+    return RFE_DAEMON_SOCKET;
+  }
+  
+  unlink(path.c_str());
+  
+  if (bind(server, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(server, 16) < 0) {
+    close(server);
+    delete gpio;
+    return RFE_DAEMON_SOCKET;
+  }
+  
+  // Let clients in the owner's group switch sockets too
+  chmod(path.c_str(), 0660);
+  
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = catch_stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  
+  printf("Listening on %s (%d codes, %d scenes%s, %s gpio, pin %d)\n",
+         path.c_str(), (int)state.codes.size(), (int)state.scenes.size(),
+         cached ? " from cache" : "", gpio->getName(), pin);
+  fflush(stdout);
+  
+  TransmitQueue queue(*gpio);
+  list<Client*> clients;
+  sigset_t      old;
+  
+  block_stop_signals(old);
+  queue.start();
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  
+  while (!STOP)
+  {
+    int fd = accept(server, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    
+    reap_clients(clients, false);
+    
+    Client* client = new Client();
+    client->fd    = fd;
+    client->done  = false;
+    
+    block_stop_signals(old);
+    client->thread = std::thread(serve_client, client, std::ref(state), std::ref(queue));
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    
+    clients.push_back(client);
+  }
+  
+  // Let waiting clients go before disconnecting them
+  queue.stop();
+  reap_clients(clients, true);
+  
+  TransmitStats stats = queue.getStats();
+  printf("Sent %ld commands (%ld superseded, %ld merged, %ld expired), %.1f s airtime\n",
+         stats.sent, stats.superseded, stats.merged, stats.expired, stats.airtime/1e9);
+  
+  close(server);
+  unlink(path.c_str());
+  
+  gpio->close();
+  delete gpio;
+  
+  return RFE_NO_ERROR;
+};
+
+/**
+ *  Client side: forwards a switch request to a running daemon
+ *  and reports its answer.
+ */
+RF_ERROR daemon_request(const char* path, const char* command) {
+  sockaddr_un addr;
+  char        line[DAEMON_LINE_SIZE];
+  int         fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  
+  if (fd < 0 || !make_address(path, addr) ||
+      connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return RFE_DAEMON_CONNECT;
+  }
+  
+  snprintf(line, sizeof(line), "%s\n", command);
+  reply(fd, line);
+  
+  int used = 0;
+  while (used < (int)sizeof(line)-1) {
+    ssize_t n = read(fd, line+used, sizeof(line)-1-used);
+    if (n <= 0) {
+      break;
+    }
+    used += (int)n;
+    if (memchr(line, '\n', used) != NULL) {
+      break;
+    }
+  }
+  line[used] = 0;
+  close(fd);
+  
+  int code = RFE_DAEMON_CONNECT;
+  
+  if (strncmp(line, "ok", 2) == 0) {
+    printf("%s", line);
+    return RFE_NO_ERROR;
+  }
+  
+  sscanf(line, "error %d", &code);
+  return (RF_ERROR)code;
+};
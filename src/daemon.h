@@ -0,0 +1,36 @@
+/**
+ *  @file   daemon.h
+ *  @author Weston Nielson <wnielson@github>
+ *
+ *  A long-running process that keeps the parsed codes and
+ *  the GPIO mapping resident and accepts switch requests on
+ *  a Unix socket, one command per line:
+ *
+ *    switch <id> <on|off> [priority=<n>] [deadline=<ms>]
+ *                           ->  ok latency=<ns> queued=<ns> airtime=<ns>
+ *    scene <name> [...]     ->  ok latency=<ns> queued=<ns> airtime=<ns>
+ *    stats                  ->  ok sent=<n> superseded=<n> ...
+ *    ping                   ->  ok
+ *
+ *  Every transmission goes through one TransmitQueue, so
+ *  concurrent clients take turns on the air.  A command that
+ *  a later one for the same switch made pointless is answered
+ *  with ``ok superseded``, and one that joined an identical
+ *  burst already on the air with ``ok merged``.  Failures are
+ *  answered with ``error <code> <message>``.
+ *
+ */
+
+#ifndef rfswitch_daemon_h
+#define rfswitch_daemon_h
+
+#include "error.h"
+
+// Kept where get_run_path says, unless -S names another path
+#define DAEMON_SOCKET     "rfswitch.sock"
+#define DAEMON_LINE_SIZE  (256)
+
+int       run_daemon(int argc, char **argv);
+RF_ERROR  daemon_request(const char* socket, const char* command);
+
+#endif
@@ -19,7 +19,18 @@ enum RF_ERROR {
   RFE_INVALID_ARGS    = 0x1A02,
   
   RFE_GPIO_NO_ACCESS  = 0x2A01,
-  RFE_INVALID_ID      = 0x4C01
+  RFE_INVALID_ID      = 0x4C01,
+  RFE_INVALID_CONFIG  = 0x4C02,
+  RFE_CACHE_WRITE     = 0x4C03,
+  
+  RFE_NO_AUDIO        = 0x5C01,
+  RFE_INPUT_OPEN      = 0x5C02,
+  RFE_INPUT_FORMAT    = 0x5C03,
+  
+  RFE_DAEMON_SOCKET   = 0x6D01,
+  RFE_DAEMON_CONNECT  = 0x6D02,
+  RFE_DEADLINE        = 0x6D03,
+  RFE_DAEMON_STOPPING = 0x6D04
 };
 
 inline const char* get_error_msg(RF_ERROR error) {
@@ -36,6 +47,17 @@ inline const char* get_error_msg(RF_ERROR error) {
     case RFE_GPIO_NO_ACCESS:  result = "Unable to access GPIO"; break;
 
     case RFE_INVALID_ID:      result = "Invalid switch id"; break;
+    case RFE_INVALID_CONFIG:  result = "Invalid config file"; break;
+    case RFE_CACHE_WRITE:     result = "Unable to write config cache"; break;
+      
+    case RFE_NO_AUDIO:        result = "Live capture requires PortAudio support"; break;
+    case RFE_INPUT_OPEN:      result = "Unable to open input"; break;
+    case RFE_INPUT_FORMAT:    result = "Unsupported input format"; break;
+      
+    case RFE_DAEMON_SOCKET:   result = "Unable to create daemon socket"; break;
+    case RFE_DAEMON_CONNECT:  result = "Unable to reach daemon"; break;
+    case RFE_DEADLINE:        result = "Deadline passed before the transmitter was free"; break;
+    case RFE_DAEMON_STOPPING: result = "Daemon is shutting down"; break;
       
     default: result = "Invalid error code"; break;
   }
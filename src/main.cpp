@@ -7,10 +7,10 @@
 #include "config.h"
 #include "switch.h"
 #include "error.h"
-
-#ifdef HAVE_PORTAUDIO_H
 #include "record.h"
-#endif 
+#include "daemon.h"
+#include "Gpio.h"
+#include "Sniffer.h"
 
 #include <cstdio>
 #include <cstdlib>
@@ -25,17 +25,59 @@ void print_usage() {
   printf("Based on code originially by Geoff Johnson.\n\n");
   printf("Usage:\n\n");
   printf("  rfswitch s(witch) [options] <id> <action> : Turn switch on/off\n");
-  
-#ifdef HAVE_PORTAUDIO_H
-  printf("  rfswitch r(ecord)                         : Record signal and extract code\n");
-#endif
+  printf("  rfswitch s(witch) [options] <scene>       : Switch every socket in a scene\n");
+  printf("  rfswitch r(ecord) [options] [input]       : Record signal and extract code\n");
+  printf("  rfswitch sniff [options] [input]          : Stream every decoded code as events\n");
+  printf("  rfswitch daemon [options]                 : Serve switch requests on a socket\n");
+  printf("  rfswitch compile [-c<path>] [-o<path>]    : Compile the config into a binary cache\n");
   
   printf("\nValid choices for 'action' are 'on' or 'off' and 'id' should be a\n");
   printf("valid switch id listed in the config file.\n\n");
   printf("Options:\n\n");
   printf(" -c<path> : Path to config file. (Defaults to $HOME/.rfswitch)\n");
   printf(" -l       : List available switches and exit.\n");
+  printf(" -g<name> : GPIO backend: auto, mem, gpiomem, chip[:<dev>] or sim[:<file>].\n");
+  printf("            (Defaults to auto, which prefers /dev/gpiomem)\n");
+  printf(" -p<pin>  : GPIO pin (0-%d) the transmitter is connected to. (Defaults to %d)\n",
+         GPIO_MAX_PIN, GPIO_DEFAULT_PIN);
+  printf(" -d       : Send the request through a running daemon.\n");
+  printf(" -S<path> : Daemon socket path. (Defaults to %s/%s, or\n", RUN_DIR, DAEMON_SOCKET);
+  printf("            $XDG_RUNTIME_DIR/%s/%s without access to it)\n", RUN_USER_DIR, DAEMON_SOCKET);
+  printf(" --priority=<n> : With -d, send before queued commands of lower\n");
+  printf("            priority. (Defaults to 0)\n");
+  printf(" --deadline=<ms> : With -d, give up if the transmitter isn't free\n");
+  printf("            within <ms>.\n");
+  printf(" --trace-timing[=<file>] : Report how closely each pulse matched its\n");
+  printf("            configured length, optionally dumping raw edge times.\n");
+  printf(" --realtime[=<cpu>] : Transmit with SCHED_FIFO priority and locked\n");
+  printf("            memory, pinned to <cpu> (or an isolated CPU, if any).\n");
   printf(" -h       : Display this help text and exit.\n\n");
+  printf("Record options:\n\n");
+  printf(" -i, --input <path>  : Decode a WAV or raw PCM file instead of a live\n");
+  printf("                       device; '-' reads from stdin.\n");
+  printf(" -f, --format <fmt>  : Input format: auto, wav, f32 or s16. (Defaults to auto)\n");
+  printf(" -d, --device <list> : Input devices to open instead of prompting, e.g.\n");
+  printf("                       '2' or '2:4,3' (device 2 with 4 channels, then 3).\n");
+  printf(" -n, --channels <n>  : Channels to decode on devices without a count.\n");
+  printf("                       (Defaults to 1)\n");
+  printf(" -j, --jobs <n>      : Decoder threads. (Defaults to one per CPU)\n");
+  printf(" -t, --threshold <x> : Use a fixed 1/0 threshold instead of following the\n");
+  printf("                       input's noise floor and signal level.\n");
+  printf(" -m, --margin <n>    : Accept a code once it leads every other by <n>\n");
+  printf("                       frames; 0 always waits for %d. (Defaults to %d)\n",
+         CODE_COUNT+1, CONFIDENCE_MARGIN);
+  printf(" -e, --precision <p> : Percent error allowed in the mean timings of a\n");
+  printf("                       code accepted early. (Defaults to %.1f)\n", CONFIDENCE_PRECISION);
+  printf(" -r, --rate <hz>     : Sample rate of the devices (and of raw input).\n");
+  printf("                       (Defaults to %.0f)\n", SAMPLE_RATE);
+  printf(" --decode-rate <hz>  : Input at a multiple of this rate is decimated\n");
+  printf("                       to it before decoding. (Defaults to %.0f)\n", DECODE_RATE);
+  printf(" --stats[=<s>]       : Report decoder counters and per-buffer timing when\n");
+  printf("                       done, and dump them to stderr every <s> seconds.\n\n");
+  printf("Sniff options (plus the record options; -d or an input is required):\n\n");
+  printf(" -o, --output <fmt>  : Event format: json or kv. (Defaults to json)\n");
+  printf(" -w, --window <ms>   : Repeats of a code less than <ms> apart are one\n");
+  printf("                       event. (Defaults to %d)\n\n", SNIFF_MERGE_MS);
 };
 
 int quit(int code, bool show_usage) {
@@ -58,12 +100,25 @@ int main(int argc, char **argv) {
     rc = run_switch(argc-1, argv+1);
   }
   
-#ifdef HAVE_PORTAUDIO_H
   else if (strcmp(argv[1], "r") == 0 || strcmp(argv[1], "record") == 0)
   {
     rc = run_record(argc-1, argv+1);
   }
-#endif
+  
+  else if (strcmp(argv[1], "sniff") == 0)
+  {
+    rc = run_sniff(argc-1, argv+1);
+  }
+  
+  else if (strcmp(argv[1], "compile") == 0)
+  {
+    rc = run_compile(argc-1, argv+1);
+  }
+  
+  else if (strcmp(argv[1], "daemon") == 0)
+  {
+    rc = run_daemon(argc-1, argv+1);
+  }
   
   else {
     quit(RFE_INCORRECT_ARGS, true);
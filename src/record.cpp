@@ -3,60 +3,556 @@
  *  @author Weston Nielson <wnielson@github>
  *
  */
-#ifdef HAVE_PORTAUDIO_H
 #include "config.h"
 
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <cmath>
 #include <list>
 #include <map>
+#include <getopt.h>
+#include <mutex>
 #include <signal.h>
+#include <time.h>
+#include <vector>
 
+#ifdef HAVE_PORTAUDIO_H
 #include <portaudio.h>
+#include <atomic>
+#include <thread>
+#include <unistd.h>
+#include "RingBuffer.h"
+#endif
 
+#include "EventWriter.h"
 #include "Sampler.h"
+#include "SampleReader.h"
+#include "Sniffer.h"
 #include "record.h"
+#include "error.h"
 
-typedef float SAMPLE;
+typedef int16_t SAMPLE;   // Matches PA_SAMPLE_TYPE
 bool ABORT = false;
 
-struct Bit {
-  int count;
-  int state;  // 1 or 0
+using namespace std;
+
+// An input device and how many of its channels carry receivers
+struct DeviceSpec {
+  int id;
+  int channels;
 };
 
-int quit(int rc) {
-  Pa_Terminate();
-  exit(rc);
+// How each decoder is tuned from the command line
+struct DecodeOptions {
+  float           threshold;  // Fixed 1/0 threshold, or 0 to adapt
+  int             margin;
+  float           precision;
+  
+  // Rate devices are opened at (and raw input is taken to be at),
+  // and the lowest rate input is decimated to
+  double          rate;
+  double          decode_rate;
+  
+  // Set when sniffing: every frame becomes an event on ``events``
+  EventWriter*    events;
+  Sniffer::FORMAT format;
+  int             merge_ms;
+  
+  // --stats: report decoder counters, and dump them every
+  // ``stats_interval`` seconds if that is set
+  bool            stats;
+  int             stats_interval;
 };
 
+// Serialises output from the decoders of different channels
+static std::mutex OUTPUT_LOCK;
+
 static void catch_function(int signal) {
   ABORT = true;
 };
 
-int run_record(int argc, char **argv) {
-  int                 numInputDevices;
+static double now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+};
+
+static void configure_sampler(Sampler& sampler, const DecodeOptions& options) {
+  if (options.threshold > 0) {
+    sampler.setThreshold(options.threshold);
+  }
+  sampler.setConfidence(options.margin, options.precision);
+};
+
+/**
+ *  Writes a decoder's counters as one parseable line on stderr.
+ */
+static void dump_stats(const char* source, Sampler& sampler) {
+  std::lock_guard<std::mutex> lock(OUTPUT_LOCK);
   
-	PaError             err;
-  PaStreamParameters  inputParameters;
-  PaStream*           stream;
+  sampler.getStats().dump(stderr, source, sampler.getInputRate());
+  fflush(stderr);
+};
+
+/**
+ *  Prints the counters of each decoder and, with several, their
+ *  total.  Only call once decoding has stopped.
+ */
+static void report_stats(FILE* fh, const vector<Sampler*>& samplers, const vector<string>& sources) {
+  DecodeStats total;
+  
+  fprintf(fh, "\nDecoder statistics\n");
+  
+  for (size_t i=0; i < samplers.size(); i++) {
+    const DecodeStats& stats = samplers[i]->getStats();
+    
+    if (samplers.size() > 1) {
+      fprintf(fh, " [%s]\n", sources[i].c_str());
+    }
+    stats.report(fh, samplers[i]->getInputRate());
+    total.merge(stats);
+  }
+  
+  if (samplers.size() > 1) {
+    fprintf(fh, " total\n");
+    total.report(fh, samplers[0]->getInputRate());
+  }
+};
+
+/**
+ *  Parses a device list such as ``2`` or ``2:4,3`` (device 2
+ *  with 4 channels, device 3 with ``channels``) into ``devices``.
+ */
+static bool parse_devices(const char* arg, int channels, vector<DeviceSpec>& devices) {
+  const char* p = arg;
+  
+  while (*p != '\0') {
+    DeviceSpec  spec;
+    char*       end;
+    
+    spec.id       = (int)strtol(p, &end, 10);
+    spec.channels = channels;
+    
+    if (end == p || spec.id < 0) {
+      return false;
+    }
+    p = end;
+    
+    if (*p == ':') {
+      spec.channels = (int)strtol(p+1, &end, 10);
+      if (end == p+1 || spec.channels < 1) {
+        return false;
+      }
+      p = end;
+    }
+    
+    devices.push_back(spec);
+    
+    if (*p == ',') {
+      p++;
+    } else if (*p != '\0') {
+      return false;
+    }
+  }
+  
+  return !devices.empty();
+};
+
+/**
+ *  Prints a code found on one channel of a multi-channel
+ *  source, tagged ``[source:channel]``.
+ */
+static void print_result(const char* source, int channel, const Sampler::Result& result) {
+  std::lock_guard<std::mutex> lock(OUTPUT_LOCK);
+  
+  printf("[%s:%d] Found code\n", source, channel);
+  if (strcmp(result.protocol, "legacy") != 0) {
+    printf("  protocol: %s\n", result.protocol);
+    printf("  symbols:  %s\n", result.symbols);
+  }
+  printf("  code:     %s\n", result.code);
+  printf("  timings:  %d,%d,%d,%d\n", result.timings[0], result.timings[1],
+                                      result.timings[2], result.timings[3]);
+  printf("  level:    threshold %.4f, SNR %.1f dB\n", result.threshold, result.snr);
+  printf("  frames:   %d\n", result.frames);
+  fflush(stdout);
+};
+
+/**
+ *  Says what rate ``sampler`` decodes at, if its input is
+ *  decimated.
+ */
+static void print_rate(FILE* fh, Sampler& sampler) {
+  if (sampler.getRate() != sampler.getInputRate()) {
+    fprintf(fh, "Decimating %.0f Hz input to %.0f Hz\n", sampler.getInputRate(), sampler.getRate());
+  }
+};
+
+/**
+ *  Reads the rest of ``reader`` as ``T``, the type the input
+ *  holds, and feeds each channel to its decoder; a mono input
+ *  is decoded straight from the read buffer.  Stops early
+ *  once a mono input (that isn't being sniffed) has given up
+ *  its code.  Returns the number of samples read.
+ */
+template <typename T>
+static long decode_input(SampleReader& reader, const vector<Sampler*>& samplers,
+                         const vector<Sniffer*>& sniffers, const vector<string>& sources,
+                         const DecodeOptions& options, int& found) {
+  int       channels  = reader.getChannels();
+  vector<T> frameBlock(INPUT_FRAMES_PER_BUFFER * channels);
+  vector<T> sampleBlock(INPUT_FRAMES_PER_BUFFER);
+  long      samples   = 0;
+  double    next_dump = now() + options.stats_interval;
+  
+  while (!ABORT && (channels > 1 || found == 0 || !sniffers.empty()))
+  {
+    int count = reader.readFrames(&frameBlock[0], INPUT_FRAMES_PER_BUFFER);
+    if (count <= 0) {
+      break;
+    }
+    
+    samples += (long)count * channels;
+    
+    for (int c=0; c < channels; c++) {
+      const T* block = &frameBlock[0];
+      
+      if (channels > 1) {
+        for (int i=0; i < count; i++) {
+          sampleBlock[i] = frameBlock[i*channels + c];
+        }
+        block = &sampleBlock[0];
+      }
+      
+      if (samplers[c]->sample(block, count)) {
+        found++;
+        if (channels > 1 && sniffers.empty()) {
+          print_result("input", c, samplers[c]->getResult());
+        }
+      }
+      
+      if (!sniffers.empty()) {
+        sniffers[c]->flush();
+      }
+    }
+    
+    if (options.stats_interval > 0 && now() >= next_dump) {
+      for (int c=0; c < channels; c++) {
+        dump_stats(sources[c].c_str(), *samplers[c]);
+      }
+      next_dump += options.stats_interval;
+    }
+  }
+  
+  return samples;
+};
+
+/**
+ *  Decodes samples from a file (or stdin) as fast as they
+ *  can be read, then reports the achieved throughput.  Each
+ *  channel of a multi-channel input gets its own decoder and
+ *  the whole input is read; a mono input stops at the first
+ *  code, as live capture does, unless sniffing.
+ */
+static int record_input(const char* path, SampleReader::FORMAT format, const DecodeOptions& options) {
+  SampleReader      reader;
+  vector<Sampler*>  samplers;
+  vector<Sniffer*>  sniffers;
+  vector<string>    sources;
+  long              samples = 0;
+  int               found   = 0;
+  
+  // Events own stdout while sniffing
+  FILE*             info    = options.events ? stderr : stdout;
+  
+  RF_ERROR rc = reader.open(path, format, (int)options.rate);
+  if (rc != RFE_NO_ERROR) {
+    return rc;
+  }
+  
+  int channels = reader.getChannels();
+  
+  for (int c=0; c < channels; c++) {
+    char source[SOURCE_LABEL_SIZE];
+    snprintf(source, sizeof(source), "input:%d", c);
+    sources.push_back(source);
+    
+    samplers.push_back(new Sampler(reader.getRate(), options.decode_rate));
+    samplers[c]->setVerbose(channels == 1);
+    configure_sampler(*samplers[c], options);
+    
+    if (options.events != NULL) {
+      sniffers.push_back(new Sniffer(*samplers[c], source, *options.events,
+                                     options.format, options.merge_ms));
+    }
+  }
+  
+  fprintf(info, "Reading from %s", (path[0] == '-' && path[1] == 0) ? "stdin" : path);
+  if (channels > 1) {
+    fprintf(info, ", %d channels", channels);
+  }
+  fprintf(info, "\n");
+  print_rate(info, *samplers[0]);
+  
+  double start = now();
+  
+  switch (reader.getSampleType())
+  {
+    case SAMPLE_S16:
+      samples = decode_input<int16_t>(reader, samplers, sniffers, sources, options, found);
+      break;
+    case SAMPLE_S32:
+      samples = decode_input<int32_t>(reader, samplers, sniffers, sources, options, found);
+      break;
+    case SAMPLE_F32:
+      samples = decode_input<float>(reader, samplers, sniffers, sources, options, found);
+      break;
+  }
+  
+  double  elapsed = now() - start;
+  long    events  = 0;
+  
+  for (size_t c=0; c < sniffers.size(); c++) {
+    sniffers[c]->finish();
+    events += sniffers[c]->getEventCount();
+  }
+  
+  if (ABORT) {
+    fprintf(info, "\rSampling aborted\n");
+  } else if (found == 0 && sniffers.empty()) {
+    printf("\nNo code found\n");
+  }
+  
+  fprintf(info, "\nDone recording samples\n");
+  fprintf(info, "  samples:    %ld (%.1f s of audio)\n", samples, samples/(double)channels/reader.getRate());
+  fprintf(info, "  elapsed:    %.3f s\n", elapsed);
+  if (elapsed > 0) {
+    fprintf(info, "  throughput: %.0f samples/s (%.1fx real-time)\n",
+            samples/elapsed, samples/elapsed/channels/reader.getRate());
+  }
+  if (channels == 1) {
+    fprintf(info, "  threshold:  %.4f (SNR %.1f dB)\n", samplers[0]->getThreshold(), samplers[0]->getSNR());
+  }
+  if (!sniffers.empty()) {
+    fprintf(info, "  events:     %ld\n", events);
+  }
+  if (options.stats) {
+    report_stats(info, samplers, sources);
+  }
+  
+  for (int c=0; c < channels; c++) {
+    if (!sniffers.empty()) {
+      delete sniffers[c];
+    }
+    delete samplers[c];
+  }
+  
+  return RFE_NO_ERROR;
+};
+
+#ifdef HAVE_PORTAUDIO_H
+
+static int quit(int rc) {
+  Pa_Terminate();
+  exit(rc);
+};
+
+/**
+ *  One receiver: a single channel of an input device.  The
+ *  PortAudio callback copies the channel's samples into the
+ *  ring, and a worker thread drains the ring into the
+ *  channel's own Sampler.  Whenever samples are lost, either
+ *  because the ring was full or because PortAudio reported an
+ *  overflow, the stream position is queued in ``gaps`` so the
+ *  decoder can throw away the partial code at exactly that
+ *  point.
+ */
+struct Capture {
+  Capture(int device, int channel, double rate, double decode_rate)
+  : device(device), channel(channel), samples(CAPTURE_RING_SIZE),
+    gaps(CAPTURE_GAP_SIZE), last_gap(-1), sampler(rate, decode_rate), sniffer(NULL)
+  {};
+  
+  ~Capture()
+  {
+    delete sniffer;
+  };
+  
+  int                       device;
+  int                       channel;
+  
+  RingBuffer<SAMPLE>        samples;
+  RingBuffer<unsigned long> gaps;
+  long                      last_gap;   // Only touched by the callback
+  
+  Sampler                   sampler;    // Only touched by its worker
+  Sniffer*                  sniffer;    // Likewise; NULL unless sniffing
+};
+
+struct Device {
+  Device()
+  : id(-1), channels(1), stream(NULL), overflows(0), dropped(0)
+  {};
+  
+  int                       id;
+  int                       channels;
+  PaStream*                 stream;
+  vector<Capture*>          captures;
+  
+  std::atomic<long>         overflows;
+  std::atomic<long>         dropped;
+};
+
+// Set once capture should end; workers poll it
+static std::atomic<bool>  CAPTURE_DONE(false);
+
+static void mark_gap(Capture* capture) {
+  unsigned long pos = capture->samples.getWriteCount();
+  
+  // Back-to-back losses are a single gap; if the gap queue is
+  // full the loss is folded into a gap the decoder already knows of
+  if ((long)pos != capture->last_gap && capture->gaps.write(&pos, 1)) {
+    capture->last_gap = (long)pos;
+  }
+};
+
+/**
+ *  Runs on PortAudio's thread, so all it does is copy each
+ *  channel's samples out of the interleaved input into that
+ *  channel's ring.
+ */
+static int capture_callback(const void* input, void* output,
+                            unsigned long frames,
+                            const PaStreamCallbackTimeInfo* timeInfo,
+                            PaStreamCallbackFlags statusFlags,
+                            void* userData) {
+  Device*       device  = (Device*)userData;
+  const SAMPLE* in      = (const SAMPLE*)input;
+  
+  if (statusFlags & paInputOverflow) {
+    device->overflows++;
+    for (size_t c=0; c < device->captures.size(); c++) {
+      mark_gap(device->captures[c]);
+    }
+  }
+  
+  if (in == NULL) {
+    return paContinue;
+  }
+  
+  for (size_t c=0; c < device->captures.size(); c++) {
+    Capture* capture = device->captures[c];
+    
+    if (!capture->samples.write(in + capture->channel, frames, device->channels)) {
+      device->overflows++;
+      device->dropped += frames;
+      mark_gap(capture);
+    }
+  }
+  
+  return paContinue;
+};
+
+/**
+ *  Decodes at most one batch from ``capture``.  Returns the
+ *  number of samples taken from the ring, or -1 if there was
+ *  a gap to skip; ``found`` is set if a code was decoded.
+ */
+static long drain_capture(Capture* capture, SAMPLE* block, bool& found) {
+  unsigned long pos   = capture->samples.getReadCount();
+  unsigned long want  = CAPTURE_BATCH_SIZE;
+  unsigned long gap;
+  
+  // Never decode across a gap
+  if (capture->gaps.peek(gap)) {
+    if (gap <= pos) {
+      capture->gaps.read(&gap, 1);
+      capture->sampler.rewind();
+      return -1;
+    }
+    if (gap - pos < want) {
+      want = gap - pos;
+    }
+  }
+  
+  unsigned long count = capture->samples.read(block, want);
+  
+  found = (count > 0 && capture->sampler.sample(block, (int)count));
+  return (long)count;
+};
+
+/**
+ *  Worker thread: round-robins over its own share of the
+ *  captures, so no two threads ever touch the same Sampler.
+ *  With ``stop_on_found`` the first code ends capture;
+ *  otherwise every code is printed with its device and
+ *  channel (or, when sniffing, every frame goes to the
+ *  capture's Sniffer) and capture carries on.  With a
+ *  ``stats_interval`` the worker also dumps its captures'
+ *  counters that often.
+ */
+static void decode_captures(vector<Capture*> captures, bool stop_on_found, int stats_interval) {
+  SAMPLE sampleBlock[CAPTURE_BATCH_SIZE];
+  double next_dump = now() + stats_interval;
+  
+  while (!CAPTURE_DONE)
+  {
+    bool idle = true;
+    
+    if (stats_interval > 0 && now() >= next_dump) {
+      for (size_t i=0; i < captures.size(); i++) {
+        char source[SOURCE_LABEL_SIZE];
+        snprintf(source, sizeof(source), "%d:%d", captures[i]->device, captures[i]->channel);
+        dump_stats(source, captures[i]->sampler);
+      }
+      next_dump += stats_interval;
+    }
+    
+    for (size_t i=0; i < captures.size() && !CAPTURE_DONE; i++) {
+      bool  found = false;
+      long  count = drain_capture(captures[i], sampleBlock, found);
+      
+      if (count != 0) {
+        idle = false;
+      }
+      
+      if (captures[i]->sniffer != NULL) {
+        captures[i]->sniffer->flush();
+        continue;
+      }
+      
+      if (!found) {
+        continue;
+      }
+      
+      if (stop_on_found) {
+        CAPTURE_DONE = true;
+      } else {
+        char source[SOURCE_LABEL_SIZE];
+        snprintf(source, sizeof(source), "%d", captures[i]->device);
+        print_result(source, captures[i]->channel, captures[i]->sampler.getResult());
+      }
+    }
+    
+    if (idle) {
+      // Let the rings fill up again
+      usleep(CAPTURE_POLL_US);
+    }
+  }
+};
+
+/**
+ *  Asks which input device to use.
+ */
+static int select_device() {
+  int                 numInputDevices;
   const PaDeviceInfo* deviceInfo;
   
   int*                inputDevices;
   int                 dev_id = -1;
   bool                valid_device = false;
-  SAMPLE              sampleBlock[FRAMES_PER_BUFFER];
-  Sampler             sampler;
-  
-  signal(SIGINT, catch_function);
   
-	err = Pa_Initialize();
-	if (err != paNoError) {
-    printf("Error: %s\n", Pa_GetErrorText(err));
-		quit(1);
-	}
-	
   numInputDevices = 0;
   for (int i=0; i < Pa_GetDeviceCount(); i++ ) {
 		deviceInfo = Pa_GetDeviceInfo(i);
@@ -100,75 +596,391 @@ int run_record(int argc, char **argv) {
     
   }
   
-  printf("Listening on device %d (%s)\n", dev_id, Pa_GetDeviceInfo(dev_id)->name);
+  delete[] inputDevices;
   
-  inputParameters.device = dev_id;
-  inputParameters.channelCount = 1;
-  inputParameters.sampleFormat = PA_SAMPLE_TYPE;
-  inputParameters.suggestedLatency = Pa_GetDeviceInfo( inputParameters.device )->defaultLowInputLatency;
-  inputParameters.hostApiSpecificStreamInfo = NULL;
+  return dev_id;
+};
+
+static int record_device(vector<DeviceSpec> specs, int channels, int jobs, const DecodeOptions& options) {
+	PaError             err;
+  PaStreamParameters  inputParameters;
+  vector<Device*>     devices;
+  vector<Capture*>    captures;
+  FILE*               info = options.events ? stderr : stdout;
   
-  err = Pa_OpenStream(
-                      &stream,
-                      &inputParameters,
-                      NULL,                  /* &outputParameters, */
-                      SAMPLE_RATE,
-                      FRAMES_PER_BUFFER,
-                      paClipOff,            /* we won't output out of range samples so don't bother clipping them */
-                      NULL,
-                      NULL);
+	err = Pa_Initialize();
+	if (err != paNoError) {
+    printf("Error: %s\n", Pa_GetErrorText(err));
+		quit(1);
+	}
   
-  if( err != paNoError ) {
-    quit(1);
+  if (specs.empty()) {
+    DeviceSpec spec;
+    spec.id       = select_device();
+    spec.channels = channels;
+    specs.push_back(spec);
   }
   
-  err = Pa_StartStream( stream );
-  if( err != paNoError ) {
-    quit(1);
+  for (size_t d=0; d < specs.size(); d++) {
+    const PaDeviceInfo* deviceInfo = NULL;
+    
+    if (specs[d].id < Pa_GetDeviceCount()) {
+      deviceInfo = Pa_GetDeviceInfo(specs[d].id);
+    }
+    
+    if (deviceInfo == NULL || deviceInfo->maxInputChannels < specs[d].channels) {
+      printf("Error: Device %d doesn't have %d input channel(s)\n", specs[d].id, specs[d].channels);
+      quit(1);
+    }
+    
+    Device* device    = new Device();
+    device->id        = specs[d].id;
+    device->channels  = specs[d].channels;
+    
+    for (int c=0; c < device->channels; c++) {
+      Capture* capture = new Capture(device->id, c, options.rate, options.decode_rate);
+      device->captures.push_back(capture);
+      captures.push_back(capture);
+    }
+    
+    if (device->channels > 1) {
+      fprintf(info, "Listening on device %d (%s), %d channels\n", device->id, deviceInfo->name, device->channels);
+    } else {
+      fprintf(info, "Listening on device %d (%s)\n", device->id, deviceInfo->name);
+    }
+    
+    inputParameters.device = device->id;
+    inputParameters.channelCount = device->channels;
+    inputParameters.sampleFormat = PA_SAMPLE_TYPE;
+    inputParameters.suggestedLatency = deviceInfo->defaultLowInputLatency;
+    inputParameters.hostApiSpecificStreamInfo = NULL;
+    
+    err = Pa_OpenStream(
+                        &device->stream,
+                        &inputParameters,
+                        NULL,                  /* &outputParameters, */
+                        options.rate,
+                        FRAMES_PER_BUFFER,
+                        paClipOff,            /* we won't output out of range samples so don't bother clipping them */
+                        capture_callback,
+                        device);
+    
+    if( err != paNoError ) {
+      quit(1);
+    }
+    
+    devices.push_back(device);
   }
   
-  while (!ABORT)
-  {
-    err = Pa_ReadStream(stream, sampleBlock, FRAMES_PER_BUFFER);
+  print_rate(info, captures[0]->sampler);
+  
+  // A single receiver keeps the interactive output and stops at
+  // the first code; with several, each code is tagged instead
+  bool stop_on_found = (captures.size() == 1 && options.events == NULL);
+  
+  for (size_t i=0; i < captures.size(); i++) {
+    captures[i]->sampler.setVerbose(stop_on_found);
+    configure_sampler(captures[i]->sampler, options);
     
-    if (err != paNoError)
-    {
-      if (err == paInputOverflowed) {
-        // We can ignore input overflows because we will just
-        // discard this data and reset the current code capture
-        sampler.rewind();
-      } else {
-        // This is a more serious error, so just spit out the
-        // error and bail
-        printf("Error message: %s\n", Pa_GetErrorText(err));
-        quit(1);
-      }
+    if (options.events != NULL) {
+      char source[SOURCE_LABEL_SIZE];
+      snprintf(source, sizeof(source), "%d:%d", captures[i]->device, captures[i]->channel);
+      captures[i]->sniffer = new Sniffer(captures[i]->sampler, source, *options.events,
+                                         options.format, options.merge_ms);
     }
-    
-    if (sampler.sample(sampleBlock, FRAMES_PER_BUFFER)) {
-      break;
+  }
+  
+  if (jobs <= 0) {
+    jobs = (int)std::thread::hardware_concurrency();
+  }
+  if (jobs > (int)captures.size()) {
+    jobs = (int)captures.size();
+  }
+  if (jobs < 1) {
+    jobs = 1;
+  }
+  
+  // Channels are dealt out to the workers up front
+  vector< vector<Capture*> >  shares(jobs);
+  vector<std::thread>         workers;
+  
+  for (size_t i=0; i < captures.size(); i++) {
+    shares[i % jobs].push_back(captures[i]);
+  }
+  
+  for (int w=0; w < jobs; w++) {
+    workers.push_back(std::thread(decode_captures, shares[w], stop_on_found,
+                                  options.stats_interval));
+  }
+  
+  for (size_t d=0; d < devices.size(); d++) {
+    err = Pa_StartStream( devices[d]->stream );
+    if( err != paNoError ) {
+      quit(1);
+    }
+  }
+  
+  while (!ABORT && !CAPTURE_DONE) {
+    Pa_Sleep(100);
+  }
+  
+  CAPTURE_DONE = true;
+  for (size_t w=0; w < workers.size(); w++) {
+    workers[w].join();
+  }
+  
+  long events = 0;
+  
+  for (size_t i=0; i < captures.size(); i++) {
+    if (captures[i]->sniffer != NULL) {
+      captures[i]->sniffer->finish();
+      events += captures[i]->sniffer->getEventCount();
     }
   }
   
   if (ABORT) {
-    printf("\rSampling aborted\n");
+    fprintf(info, "\rSampling aborted\n");
   }
   
-  printf("\nDone recording samples\n");
+  fprintf(info, "\nDone recording samples\n");
+  if (options.events != NULL) {
+    fprintf(info, "  events:     %ld\n", events);
+  }
   
-  /* -- Now we stop the stream -- */
-  err = Pa_StopStream( stream );
-  if( err != paNoError ) {
-    quit(1);
+  for (size_t d=0; d < devices.size(); d++) {
+    Device* device = devices[d];
+    
+    if (devices.size() > 1) {
+      fprintf(info, "  device %d overflows:  %ld (%ld samples dropped)\n", device->id,
+              (long)device->overflows, (long)device->dropped);
+    } else {
+      fprintf(info, "  overflows:  %ld (%ld samples dropped)\n", (long)device->overflows, (long)device->dropped);
+    }
+    
+    for (size_t c=0; c < device->captures.size(); c++) {
+      Sampler& sampler = device->captures[c]->sampler;
+      
+      if (device->captures.size() > 1) {
+        fprintf(info, "  [%d:%d] threshold:  %.4f (SNR %.1f dB)\n", device->id, (int)c,
+                sampler.getThreshold(), sampler.getSNR());
+      } else {
+        fprintf(info, "  threshold:  %.4f (SNR %.1f dB)\n", sampler.getThreshold(), sampler.getSNR());
+      }
+    }
+    
+    /* -- Now we stop the stream -- */
+    err = Pa_StopStream( device->stream );
+    if( err != paNoError ) {
+      quit(1);
+    }
+    
+    /* -- don't forget to cleanup! -- */
+    err = Pa_CloseStream( device->stream );
+    if( err != paNoError ) {
+      quit(1);
+    };
   }
   
-  /* -- don't forget to cleanup! -- */
-  err = Pa_CloseStream( stream );
-  if( err != paNoError ) {
-    quit(1);
-  };
+  if (options.stats) {
+    vector<Sampler*> samplers;
+    vector<string>   sources;
+    
+    for (size_t i=0; i < captures.size(); i++) {
+      char source[SOURCE_LABEL_SIZE];
+      snprintf(source, sizeof(source), "%d:%d", captures[i]->device, captures[i]->channel);
+      samplers.push_back(&captures[i]->sampler);
+      sources.push_back(source);
+    }
+    report_stats(info, samplers, sources);
+  }
+  
+  for (size_t d=0; d < devices.size(); d++) {
+    for (size_t c=0; c < devices[d]->captures.size(); c++) {
+      delete devices[d]->captures[c];
+    }
+    delete devices[d];
+  }
   
 	return 0;
 };
 
 #endif
+
+/**
+ *  Shared by ``record`` and ``sniff``, which take the same
+ *  input options; ``sniff`` adds -o and -w.
+ */
+static int run_capture(int argc, char **argv, bool sniff) {
+  const char*           input     = NULL;
+  const char*           device    = NULL;
+  SampleReader::FORMAT  format    = SampleReader::FORMAT_AUTO;
+  vector<DeviceSpec>    devices;
+  int                   channels  = 1;
+  int                   jobs      = 0;
+  DecodeOptions         options   = {0, CONFIDENCE_MARGIN, CONFIDENCE_PRECISION,
+                                     SAMPLE_RATE, DECODE_RATE, NULL, Sniffer::FORMAT_JSON, SNIFF_MERGE_MS, false, 0};
+  int                   c;
+  
+  static struct option long_options[] = {
+    {"input",     required_argument, NULL, 'i'},
+    {"format",    required_argument, NULL, 'f'},
+    {"device",    required_argument, NULL, 'd'},
+    {"channels",  required_argument, NULL, 'n'},
+    {"jobs",      required_argument, NULL, 'j'},
+    {"threshold", required_argument, NULL, 't'},
+    {"margin",    required_argument, NULL, 'm'},
+    {"precision", required_argument, NULL, 'e'},
+    {"rate",      required_argument, NULL, 'r'},
+    {"decode-rate", required_argument, NULL, 'R'},
+    {"output",    required_argument, NULL, 'o'},
+    {"window",    required_argument, NULL, 'w'},
+    {"stats",     optional_argument, NULL, 'S'},
+    {"help",      no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  
+  while ((c = getopt_long(argc, argv, sniff ? "hi:f:d:n:j:t:m:e:r:o:w:" : "hi:f:d:n:j:t:m:e:r:", long_options, NULL)) != -1)
+  {
+    switch (c)
+    {
+      case 'h':
+        return RFE_SHOW_HELP;
+      case 'i':
+        input = optarg;
+        break;
+      case 'd':
+        device = optarg;
+        break;
+      case 'n':
+        channels = atoi(optarg);
+        if (channels < 1) {
+          return RFE_INVALID_ARGS;
+        }
+        break;
+      case 'j':
+        jobs = atoi(optarg);
+        break;
+      case 't':
+        options.threshold = (float)atof(optarg);
+        if (options.threshold <= 0) {
+          return RFE_INVALID_ARGS;
+        }
+        break;
+      case 'm':
+        options.margin = atoi(optarg);
+        if (options.margin < 0) {
+          return RFE_INVALID_ARGS;
+        }
+        break;
+      case 'e':
+        options.precision = (float)atof(optarg);
+        if (options.precision <= 0) {
+          return RFE_INVALID_ARGS;
+        }
+        break;
+      case 'r':
+        options.rate = atof(optarg);
+        if (options.rate < MIN_RATE) {
+          return RFE_INVALID_ARGS;
+        }
+        break;
+      case 'R':
+        options.decode_rate = atof(optarg);
+        if (options.decode_rate < MIN_RATE) {
+          return RFE_INVALID_ARGS;
+        }
+        break;
+      case 'f':
+        if (!SampleReader::parseFormat(optarg, format)) {
+          return RFE_INVALID_ARGS;
+        }
+        break;
+      case 'o':
+        if (!sniff || !Sniffer::parseFormat(optarg, options.format)) {
+          return RFE_INVALID_ARGS;
+        }
+        break;
+      case 'S':
+        options.stats = true;
+        if (optarg != NULL) {
+          options.stats_interval = atoi(optarg);
+          if (options.stats_interval <= 0) {
+            return RFE_INVALID_ARGS;
+          }
+        }
+        break;
+      case 'w':
+        options.merge_ms = atoi(optarg);
+        if (!sniff || options.merge_ms < 0) {
+          return RFE_INVALID_ARGS;
+        }
+        break;
+      default:
+        return RFE_INVALID_ARGS;
+    }
+  }
+  
+  // A trailing path (or ``-`` for stdin) is shorthand for --input
+  if (input == NULL && optind < argc) {
+    input = argv[optind];
+  }
+  
+  signal(SIGINT, catch_function);
+  
+  // Parsed last so -n applies to every device without its own count
+  if (device != NULL && !parse_devices(device, channels, devices)) {
+    return RFE_INVALID_ARGS;
+  }
+  
+  if (!sniff) {
+    if (input != NULL) {
+      return record_input(input, format, options);
+    }
+#ifdef HAVE_PORTAUDIO_H
+    return record_device(devices, channels, jobs, options);
+#else
+    // Decoder threads only serve live capture
+    (void)jobs;
+    return RFE_NO_AUDIO;
+#endif
+  }
+  
+  // The device prompt would end up in the event stream
+  if (input == NULL && devices.empty()) {
+    return RFE_INVALID_ARGS;
+  }
+  
+  signal(SIGTERM, catch_function);
+  
+  EventWriter writer(stdout);
+  int         rc = RFE_NO_AUDIO;
+  
+  // Nothing is lost by making a file wait for a slow reader
+  options.events = &writer;
+  writer.setBlocking(input != NULL);
+  writer.start();
+  
+  if (input != NULL) {
+    rc = record_input(input, format, options);
+  } else {
+#ifdef HAVE_PORTAUDIO_H
+    rc = record_device(devices, channels, jobs, options);
+#endif
+  }
+  
+  writer.stop();
+  if (rc == RFE_NO_ERROR) {
+    fprintf(stderr, "  lines:      %ld written, %ld dropped\n",
+            writer.getWritten(), writer.getDropped());
+  }
+  
+  return rc;
+};
+
+int run_record(int argc, char **argv) {
+  return run_capture(argc, argv, false);
+};
+
+int run_sniff(int argc, char **argv) {
+  return run_capture(argc, argv, true);
+};
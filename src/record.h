@@ -7,19 +7,52 @@
 #ifndef rfswitch_record_h
 #define rfswitch_record_h
 
+// Devices are opened at SAMPLE_RATE unless told otherwise.  Input
+// at twice DECODE_RATE or more is averaged down by a whole factor
+// (so 96 kHz is decoded at 48 kHz) before it is binarized.  Below
+// MIN_RATE even the longest pulses are only a few samples.
 #define SAMPLE_RATE           (44100.0)
-#define ZERO_PREAMBLE_THRESH  (SAMPLE_RATE/88)
+#define DECODE_RATE           (SAMPLE_RATE)
+#define MIN_RATE              (4000)
 
-#define PA_SAMPLE_TYPE        paFloat32
+// Most channels an input file may have; each gets its own decoder
+#define MAX_INPUT_CHANNELS    (32)
+
+// Devices are read as 16-bit integers, which is what most USB
+// interfaces deliver, and decoded without converting them
+#define PA_SAMPLE_TYPE        paInt16
 #define FRAMES_PER_BUFFER     (32)
+#define INPUT_FRAMES_PER_BUFFER (4096)
+
+// Live capture ring (about 3 s of audio) and decoder batching
+#define CAPTURE_RING_SIZE     (1<<17)
+#define CAPTURE_GAP_SIZE      (64)
+#define CAPTURE_BATCH_SIZE    (4096)
+#define CAPTURE_POLL_US       (5000)
+
+// Room for a source label, e.g. ``input:3`` or ``<device>:<channel>``
+#define SOURCE_LABEL_SIZE     (64)
 
 // 1/0 threshold
 #define SIGNAL_THRESH         (0.02)
-#define ZERO_PREAMBLE_THRESH  (SAMPLE_RATE/88)
 #define CODE_COUNT            (20)
+
+// A code is accepted early once it leads every other code of its
+// protocol by CONFIDENCE_MARGIN frames and the standard error of
+// each mean timing is within CONFIDENCE_PRECISION percent.
+// CODE_COUNT frames are always enough.
+#define CONFIDENCE_MARGIN     (3)
+#define CONFIDENCE_PRECISION  (2.0)
+#define CONFIDENCE_MIN_FRAMES (3)
 #define MIN_CODE_LENGTH       (10)
-#define MIN_BIT_LENGTH        (12)
+
+// Silence that separates two codes, and the shortest pulse a code
+// may contain, in seconds; each decoder converts them to samples at
+// its own rate.  At 44.1 kHz they come to 501 and 12 samples.
+#define ZERO_PREAMBLE_TIME    (1/88.0)
+#define MIN_BIT_TIME          (272e-6)
 
 int run_record(int argc, char **argv);
+int run_sniff(int argc, char **argv);
 
 #endif
@@ -5,20 +5,23 @@
  *  Based on the work by Geoff Johnson.
  *
  */
-#define BCM2708_PERI_BASE 0x20000000
-#define GPIO_BASE         (BCM2708_PERI_BASE + 0x200000) /* GPIO controller */
-
 #include "switch.h"
+#include "daemon.h"
 #include "error.h"
+#include "Gpio.h"
+#include "Timeline.h"
+#include "CodeCache.h"
+#include "TimingTrace.h"
+#include "Realtime.h"
 
+#include <cctype>
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
-#include <dirent.h>
 #include <fcntl.h>
-#include <assert.h>
-#include <sys/mman.h>
-#include <sys/types.h>
+#include <getopt.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
@@ -28,187 +31,492 @@
 
 using namespace std;
 
-#define PAGE_SIZE   (4*1024)
-#define BLOCK_SIZE  (4*1024)
-
-int           mem_fd;
-unsigned char *gpio_mem, *gpio_map;
-char          *spi0_mem, *spi0_map;
-
-// I/O access
-volatile unsigned *gpio;
-
-// GPIO setup macros. Always use INP_GPIO(x) before using OUT_GPIO(x) or SET_GPIO_ALT(x,y)
-#define INP_GPIO(g) *(gpio+((g)/10)) &= ~(7<<(((g)%10)*3))
-#define OUT_GPIO(g) *(gpio+((g)/10)) |=  (1<<(((g)%10)*3))
-#define SET_GPIO_ALT(g,a) *(gpio+(((g)/10))) |= (((a)<=3?(a)+4:(a)==4?3:2)<<(((g)%10)*3))
-
-#define GPIO_SET *(gpio+7)  // sets   bits which are 1 ignores bits which are 0
-#define GPIO_CLR *(gpio+10) // clears bits which are 1 ignores bits which are 0
+/**
+ *  Resolves the config path, defaulting to ~/.rfswitch.
+ */
+RF_ERROR find_config(string& config)
+{
+  if (config.empty()) {
+    config  = getenv("HOME");
+    config += "/.rfswitch";
+  }
+  
+  if (access(config.c_str(), R_OK) != 0) {
+    config = "";
+  }
+  
+  if (config.empty()) {
+    printf("Could not find config file\n");
+    return RFE_INCORRECT_ARGS;
+  }
+  
+  return RFE_NO_ERROR;
+};
 
-// Define which GPIO pin the RF transmitter is connected to
-#define PIN 7
+/**
+ *  Parses a ``scene <name> = <id>:<action> ...`` line (with the
+ *  leading keyword already skipped).
+ */
+static bool parse_scene(char* text, SceneData& scene)
+{
+  char* members = strchr(text, '=');
+  
+  if (members == NULL) {
+    return false;
+  }
+  *members++ = 0;
+  
+  char* token = strtok(text, " \t");
+  if (token == NULL || strtok(NULL, " \t") != NULL) {
+    return false;
+  }
+  scene.name = token;
+  
+  for (token = strtok(members, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n"))
+  {
+    char              action[8];
+    SceneData::Member member;
+    
+    if (sscanf(token, "%d:%7s", &member.id, action) != 2 ||
+        (member.action = get_action(action)) < 0) {
+      return false;
+    }
+    
+    scene.members.push_back(member);
+  }
+  
+  return !scene.members.empty();
+};
 
-struct CodeData {
-  int   id;
-  char  codes[2][255];
-  int   values[2][5];
+/**
+ *  Parses the optional ``repeats=<n> gap=<ns> min-frames=<n>``
+ *  profile that may follow a code's id.  ``gap`` replaces the
+ *  delay of both codes, so it is applied once they are read.
+ */
+static bool parse_profile(const char* text, CodeData& cd, int& gap)
+{
+  char  token[32];
+  int   value;
+  int   n;
+  
+  cd.repeats    = 0;
+  cd.min_frames = 0;
+  gap           = -1;
+  
+  while (sscanf(text, "%31s%n", token, &n) == 1)
+  {
+    if (sscanf(token, "repeats=%d", &value) == 1 && value > 0) {
+      cd.repeats = value;
+    } else if (sscanf(token, "min-frames=%d", &value) == 1 && value > 0) {
+      cd.min_frames = value;
+    } else if (sscanf(token, "gap=%d", &value) == 1 && value >= 0) {
+      gap = value;
+    } else {
+      return false;
+    }
+    text += n;
+  }
+  
+  if (cd.repeats == 0) {
+    cd.repeats = cd.min_frames ? cd.min_frames + REPEAT_MARGIN : REPEAT_COUNT;
+  }
+  
+  return cd.repeats >= cd.min_frames;
 };
 
-int load_codes(const char* path, list<CodeData>& codes)
+/**
+ *  Parses the config file into ``codes`` (and ``scenes``, if
+ *  given).  Returns the number of codes, or -1 if the file is
+ *  invalid; everything before the bad line is still loaded.
+ */
+int load_codes(const char* path, list<CodeData>& codes, list<SceneData>* scenes)
 {
-  int count = 0;
-  int line  = 1;
-  FILE* fh  = fopen(path, "r");
+  int       line  = 0;
+  bool      valid = true;
+  int       next  = -1;   // -1 = expecting an id, else the code index
+  int       gap   = -1;
+  char      text[512];
+  CodeData  cd;
+  FILE*     fh    = fopen(path, "r");
   
-  if (fh)
+  if (fh == NULL) {
+    return -1;
+  }
+  
+  while (fgets(text, sizeof(text), fh) != NULL)
   {
-    while (!feof(fh)) {
-      int rc;
+    char* p = text;
+    line++;
+    
+    while (isspace(*p)) {
+      p++;
+    }
+    
+    if (*p == 0) {
+      continue;
+    }
+    
+    if (next < 0 && strncmp(p, "scene", 5) == 0 && isspace(p[5]))
+    {
+      SceneData scene;
       
-      CodeData cd;
+      if (!parse_scene(p+5, scene)) {
+        printf("Invalid scene in config file, line %d\n", line);
+        valid = false;
+        break;
+      }
+      
+      if (scenes != NULL) {
+        scenes->push_back(scene);
+      }
+    }
+    
+    else if (next < 0)
+    {
+      int n;
       
-      // Get the code ID
-      rc = fscanf(fh, "%d\n", &cd.id);
-      if (rc != 1)
-      {
+      // Get the code ID, and how it should be sent
+      if (sscanf(p, "%d%n", &cd.id, &n) != 1 || !parse_profile(p+n, cd, gap)) {
         printf("Invalid config file, line %d\n", line);
+        valid = false;
         break;
       }
-      line++;
+      next = 0;
+    }
+    
+    else
+    {
+      // The field width must match MAX_CODE_BITS
+      int rc = sscanf(p, "%64[10],%d,%d,%d,%d,%d",
+                      cd.codes[next],      &cd.values[next][0],
+                      &cd.values[next][1], &cd.values[next][2],
+                      &cd.values[next][3], &cd.values[next][4]);
       
-      for (int i=0; i < 2; i++) {
-        rc = fscanf(fh, "%[10],%d,%d,%d,%d,%d\n",
-                    cd.codes[i],      &cd.values[i][0],
-                    &cd.values[i][1], &cd.values[i][2],
-                    &cd.values[i][3], &cd.values[i][4]);
-        
-        if (rc != 6)
-        {
-          if (!feof(fh)) {
-            printf("Invalid config file, line %d\n", line);
-          }
-          break;
-        }
-        line++;
+      if (rc != 6) {
+        printf("Invalid config file, line %d\n", line);
+        valid = false;
+        break;
       }
       
-      codes.push_back(cd);
+      if (gap >= 0) {
+        cd.values[next][4] = gap;
+      }
+      
+      if (++next == 2) {
+        codes.push_back(cd);
+        next = -1;
+      }
+    }
+  }
+  
+  if (valid && next >= 0) {
+    printf("Invalid config file, switch %d is incomplete\n", cd.id);
+    valid = false;
+  }
+  
+  fclose(fh);
+  
+  return valid ? (int)codes.size() : -1;
+};
+
+CodeData* find_code(list<CodeData>& codes, int id)
+{
+  CodeData* cd = NULL;
+  
+  for (list<CodeData>::iterator it = codes.begin(); it != codes.end() ; it++)
+  {
+    if ((*it).id == id) {
+      cd = &(*it);
+    }
+  }
+  
+  return cd;
+};
+
+SceneData* find_scene(list<SceneData>& scenes, const string& name)
+{
+  for (list<SceneData>::iterator it = scenes.begin(); it != scenes.end() ; it++)
+  {
+    if ((*it).name == name) {
+      return &(*it);
     }
-    count = (int)codes.size();
   }
   
-  return count;
+  return NULL;
+};
+
+/**
+ *  Maps "on"/"off" to the index of the code in CodeData, or
+ *  returns -1 for anything else.
+ */
+int get_action(const string& action)
+{
+  if (action == "on") {
+    return 0;
+  } else if (action == "off") {
+    return 1;
+  }
+  return -1;
+};
+
+/**
+ *  Builds the transmit plan for one action of a code: its
+ *  frame, repeated as many times as the code's profile says.
+ */
+void compile_code(const CodeData& cd, int action, Timeline& timeline)
+{
+  timeline.reset();
+  timeline.addCode(cd.codes[action], cd.values[action], cd.repeats);
+};
+
+/**
+ *  Builds a single transmit plan for every switch in a scene.
+ *  Rather than sending all repeats of one code before moving on
+ *  to the next, repeats are interleaved round-robin, so every
+ *  socket hears its first frame within the first pass.
+ */
+RF_ERROR compile_scene(SceneData& scene, list<CodeData>& codes, Timeline& timeline)
+{
+  vector<CodeData*> members;
+  
+  for (size_t i = 0; i < scene.members.size(); i++) {
+    CodeData* cd = find_code(codes, scene.members[i].id);
+    if (cd == NULL) {
+      return RFE_INVALID_ID;
+    }
+    members.push_back(cd);
+  }
+  
+  int repeats = 0;
+  for (size_t i = 0; i < members.size(); i++) {
+    repeats = max(repeats, members[i]->repeats);
+  }
+  
+  timeline.reset();
+  
+  // A member drops out of the rotation once its own repeats are sent
+  for (int r = 0; r < repeats; r++) {
+    for (size_t i = 0; i < members.size(); i++) {
+      int a = scene.members[i].action;
+      if (r < members[i]->repeats) {
+        timeline.addFrame(members[i]->codes[a], members[i]->values[a]);
+      }
+    }
+  }
+  
+  return RFE_NO_ERROR;
 };
 
 /*
- *  Sends the code to the RF transmitter connected to GPIO PIN.
+ *  Plays a compiled timeline out on the GPIO pin.  Each edge is
+ *  written at its absolute deadline, so lateness of one edge
+ *  doesn't push back the ones after it.  If ``first_edge`` is
+ *  given it receives the CLOCK_MONOTONIC time (ns) at which
+ *  the first edge was written.  With a ``trace``, the write time
+ *  of every edge is recorded.  Once ``cancel`` is set, playback
+ *  stops at the end of the current frame's delay; ``cut_short``
+ *  then says whether any frames were actually left out.
+ *
+ *  Returns how long (in ns) the transmitter was in use.
  *
  */
-void send_code(CodeData* cd, string& action) {
-  int   a     = (action == "on") ? 0 : 1;
-  char* code  = cd->codes[a];
+int64_t play_timeline(Timeline& timeline, Gpio& gpio, int64_t* first_edge,
+                      TimingTrace* trace, const std::atomic<bool>* cancel, bool* cut_short) {
+  timespec start;
   
-	timespec sleeptime;
-	timespec remtime;
+  Timeline::now(start);
   
-	for (int r = 0; r < 10; r++) {
+  if (cut_short != NULL) {
+    *cut_short = false;
+  }
+  
+  if (trace != NULL) {
+    trace->start(start);
+  }
+  
+  for (int i = 0; i < timeline.getSize(); i++)
+  {
+    const Edge& edge = timeline.getEdge(i);
     
-		sleeptime.tv_sec  = 0;
+    Timeline::waitUntil(start, edge.time);
     
-		for (int i = 0 ; i < strlen(code); i++)
-    {
-			if (code[i] == '1')
-      {
-        // Send long-hi...
-        sleeptime.tv_sec  = 0;
-        sleeptime.tv_nsec = cd->values[a][2];
-				GPIO_SET = 1<<7;
-        nanosleep(&sleeptime, &remtime);
-        
-        // ... and short-lo
-        sleeptime.tv_sec  = 0;
-        sleeptime.tv_nsec = cd->values[a][3];
-        GPIO_CLR = 1<<7;
-        nanosleep(&sleeptime, &remtime);
-			}
-      
-      else
-      {
-        // Send short-hi...
-        sleeptime.tv_sec  = 0;
-        sleeptime.tv_nsec = cd->values[a][0];
-				GPIO_SET = 1<<7;
-        nanosleep(&sleeptime, &remtime);
-        
-        // ... and long-lo
-        sleeptime.tv_sec  = 0;
-        sleeptime.tv_nsec = cd->values[a][1];
-        GPIO_CLR = 1<<7;
-        nanosleep(&sleeptime, &remtime);
-			}
-		}
-    
-    sleeptime.tv_sec  = 0;
-		sleeptime.tv_nsec = cd->values[a][4];
-		nanosleep(&sleeptime, &remtime);
-	}
+    // Only ever stop between frames, never part way through one
+    if (cancel != NULL && i > 0 && *cancel &&
+        timeline.getEdge(i-1).symbol == SYMBOL_GAP) {
+      if (cut_short != NULL) {
+        *cut_short = true;
+      }
+      return edge.time;
+    }
+    
+    if (edge.level) {
+      gpio.set();
+    } else {
+      gpio.clear();
+    }
+    
+    if (trace != NULL) {
+      trace->record(i);
+    }
+    
+    if (i == 0 && first_edge != NULL) {
+      timespec ts;
+      Timeline::now(ts);
+      *first_edge = ts.tv_sec*1000000000LL + ts.tv_nsec;
+    }
+  }
+  
+  // Honour the delay after the final frame
+  Timeline::waitUntil(start, timeline.getDuration());
+  
+  return timeline.getDuration();
 };
 
 /**
- *  Setup access to the GPIO pins.
- *
+ *  Returns true if ``dir`` may hold the lock and the socket: a
+ *  real directory (not a link), owned by us or root, that only
+ *  its owner and group can write to.  A group-writable one is
+ *  how a shared RuntimeDirectory lets a whole group take turns.
  */
-RF_ERROR setup_io() {
-	/* open /dev/mem */
-	if ((mem_fd = open("/dev/mem", O_RDWR|O_SYNC) ) < 0) {
-		printf("Error: Can't open /dev/mem \n");
-		return RFE_GPIO_NO_ACCESS;
-	}
-  
-	/* mmap GPIO */
-	// Allocate MAP block
-	if ((gpio_mem = (unsigned char*)malloc(BLOCK_SIZE + (PAGE_SIZE-1))) == NULL) {
-		printf("Error: Allocation error \n");
-		return RFE_GPIO_NO_ACCESS;
-	}
-  
-	// Make sure pointer is on 4K boundary
-	if ((unsigned long)gpio_mem % PAGE_SIZE) {
-		gpio_mem += PAGE_SIZE - ((unsigned long)gpio_mem % PAGE_SIZE);
-	}
-  
-	// Now map it
-	gpio_map = (unsigned char *)mmap(
-                                   (caddr_t)gpio_mem,
-                                   BLOCK_SIZE,
-                                   PROT_READ|PROT_WRITE,
-                                   MAP_SHARED|MAP_FIXED,
-                                   mem_fd,
-                                   GPIO_BASE
-                                   );
-  
-	if ((long)gpio_map < 0) {
-		printf("Error: mmap error %u\n", *gpio_map);
-		return RFE_GPIO_NO_ACCESS;
-	}
-  
-	// Always use volatile pointer!
-	gpio = (volatile unsigned *)gpio_map;
+static bool is_trusted_dir(const string& dir) {
+  struct stat st;
   
-  return RFE_NO_ERROR;
+  if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+    return false;
+  }
+  
+  if (st.st_uid != geteuid() && st.st_uid != 0) {
+    return false;
+  }
+  
+  return (st.st_mode & S_IWOTH) == 0;
+};
+
+/**
+ *  Returns the path of the runtime file ``name`` (the lock or
+ *  the daemon socket), or an empty string if there is nowhere
+ *  safe to keep it.  RUN_DIR is shared by every user, so it is
+ *  preferred: a copy of ``name`` already there is used even if
+ *  we can't write to the directory.  Otherwise ``name`` goes in
+ *  the first of RUN_DIR and ``$XDG_RUNTIME_DIR/rfswitch`` that
+ *  we can create or write to.
+ */
+string get_run_path(const char* name) {
+  vector<string>  dirs;
+  const char*     user = getenv("XDG_RUNTIME_DIR");
+  
+  dirs.push_back(RUN_DIR);
+  if (user != NULL && user[0] == '/') {
+    dirs.push_back(string(user) + "/" + RUN_USER_DIR);
+  }
+  
+  for (size_t i = 0; i < dirs.size(); i++) {
+    string path = dirs[i] + "/" + name;
+    if (is_trusted_dir(dirs[i]) && access(path.c_str(), F_OK) == 0) {
+      return path;
+    }
+  }
+  
+  for (size_t i = 0; i < dirs.size(); i++) {
+    // Creating RUN_DIR needs root; the per-user one is ours alone
+    mkdir(dirs[i].c_str(), i == 0 ? 0750 : 0700);
+    
+    if (is_trusted_dir(dirs[i]) && access(dirs[i].c_str(), W_OK | X_OK) == 0) {
+      return dirs[i] + "/" + name;
+    }
+  }
+  
+  return "";
+};
+
+/**
+ *  Waits for exclusive use of the transmitter.  Returns the
+ *  lock's descriptor, or -1 if the lock file can't be opened,
+ *  in which case we transmit anyway.
+ */
+int lock_transmitter() {
+  string path = get_run_path(TRANSMIT_LOCK);
+  
+  if (path.empty()) {
+    return -1;
+  }
+  
+  // Never follow a link someone left in the lock's place.  Anyone
+  // who can reach the directory may take the lock.
+  int fd = open(path.c_str(), O_RDONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+  
+  if (fd < 0) {
+    return -1;
+  }
+  
+  while (flock(fd, LOCK_EX) != 0) {
+    if (errno != EINTR) {
+      close(fd);
+      return -1;
+    }
+  }
+  
+  return fd;
+};
+
+void unlock_transmitter(int fd) {
+  if (fd >= 0) {
+    flock(fd, LOCK_UN);
+    close(fd);
+  }
+};
+
+/**
+ *  Prints how long each code of ``cd`` is on the air, and how
+ *  long until its receiver should have latched.
+ */
+static void print_airtime(const CodeData& cd)
+{
+  int64_t frame[2];
+  
+  for (int a = 0; a < 2; a++) {
+    Timeline timeline;
+    timeline.addFrame(cd.codes[a], cd.values[a]);
+    frame[a] = timeline.getDuration();
+  }
+  
+  printf("  air: %d frames, on %.1f ms, off %.1f ms\n", cd.repeats,
+         cd.repeats*frame[0]/1e6, cd.repeats*frame[1]/1e6);
+  
+  if (cd.min_frames > 0) {
+    printf("  latch: %d frames, on %.1f ms, off %.1f ms\n", cd.min_frames,
+           cd.min_frames*frame[0]/1e6, cd.min_frames*frame[1]/1e6);
+  }
 };
 
 int run_switch(int argc, char** argv)
 {
   int     id          = -1;
+  int     pin         = GPIO_DEFAULT_PIN;
   bool    list_codes  = false;
   string  config,
-  action;
-  bool    done = false;
-  char    c;
+  action,
+  backend             = "auto",
+  socket;
+  bool    use_daemon  = false;
+  bool    trace_timing = false;
+  string  trace_path;
+  bool    realtime    = false;
+  int     realtime_cpu = -1;
+  string  priority,
+          deadline;
+  int     c;
   
-  while (((c = getopt(argc, argv, "hlc:")) != -1) || done)
+  static struct option long_options[] = {
+    {"trace-timing",  optional_argument, NULL, 'T'},
+    {"realtime",      optional_argument, NULL, 'R'},
+    {"priority",      required_argument, NULL, 'P'},
+    {"deadline",      required_argument, NULL, 'D'},
+    {"help",          no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  
+  while ((c = getopt_long(argc, argv, "hlc:g:p:dS:", long_options, NULL)) != -1)
   {
     switch (c)
     {
@@ -221,34 +529,135 @@ int run_switch(int argc, char** argv)
       case 'c':
         config = optarg;
         break;
-      case 255:
-        done = true;
+      case 'g':
+        backend = optarg;
+        break;
+      case 'p':
+        if (!Gpio::parsePin(optarg, pin)) {
+          return RFE_INVALID_ARGS;
+        }
+        break;
+      case 'd':
+        use_daemon = true;
+        break;
+      case 'S':
+        use_daemon = true;
+        socket = optarg;
+        break;
+      case 'T':
+        trace_timing = true;
+        if (optarg != NULL) {
+          trace_path = optarg;
+        }
+        break;
+      case 'R':
+        realtime = true;
+        if (optarg != NULL) {
+          char* end;
+          long  cpu = strtol(optarg, &end, 10);
+          
+          // CPU_SET can't take anything outside its set
+          if (end == optarg || *end != '\0' || cpu < 0 || cpu >= CPU_SETSIZE) {
+            return RFE_INVALID_ARGS;
+          }
+          realtime_cpu = (int)cpu;
+        }
+        break;
+      case 'P':
+        priority = optarg;
+        break;
+      case 'D':
+        deadline = optarg;
         break;
       default:
-        printf("C: %d\n",c);
+        return RFE_INVALID_ARGS;
     }
-    
-    if (done) {
-      break;
+  }
+  
+  // Parse arguments: either <id> <action> or <scene>
+  string target;
+  int i = 0;
+  for (int index=optind; index < argc; index++) {
+    if (i == 0) {
+      target = argv[index];
+    } else if (i == 1) {
+      action = argv[index];
     }
+    i++;
   }
   
-  if (config.empty()) {
-    config  = getenv("HOME");
-    config += "/.rfswitch";
+  bool is_scene = !target.empty() && !isdigit(target[0]);
+  
+  // With a daemon running, it does all the work
+  if (use_daemon && !list_codes) {
+    string command;
+    
+    if (socket.empty()) {
+      socket = get_run_path(DAEMON_SOCKET);
+    }
+    
+    if (is_scene) {
+      command = "scene " + target;
+    } else if (!target.empty() && !action.empty()) {
+      command = "switch " + target + " " + action;
+    } else {
+      return RFE_INCORRECT_ARGS;
+    }
+    
+    if (!priority.empty()) {
+      command += " priority=" + priority;
+    }
+    if (!deadline.empty()) {
+      command += " deadline=" + deadline;
+    }
+    
+    return daemon_request(socket.c_str(), command.c_str());
   }
   
-  if (access(config.c_str(), R_OK) != 0) {
-    config = "";
+  int rc = find_config(config);
+  if (rc != RFE_NO_ERROR) {
+    return rc;
   }
   
-  if (config.empty()) {
-    printf("Could not find config file\n");
-    return RFE_INCORRECT_ARGS;
+  list<CodeData>  codes;
+  list<SceneData> scenes;
+  CodeCache       cache;
+  
+  bool            cached = false;
+  
+  // The compiled cache lets us fetch just the code (or scene)
+  // we need without parsing the text
+  if (!list_codes && cache.open(CodeCache::getPath(config), config))
+  {
+    CodeData  cd;
+    SceneData scene;
+    
+    if (is_scene) {
+      if (cache.getScene(target, scene)) {
+        cached = true;
+        scenes.push_back(scene);
+        for (size_t m = 0; m < scene.members.size(); m++) {
+          if (cache.getCode(scene.members[m].id, cd)) {
+            codes.push_back(cd);
+          } else {
+            cached = false;
+          }
+        }
+      }
+    } else if (cache.getCode(atoi(target.c_str()), cd)) {
+      cached = true;
+      codes.push_back(cd);
+    }
   }
   
-  list<CodeData> codes;
-  load_codes(config.c_str(), codes);
+  // Anything the cache couldn't answer (or a damaged entry) is
+  // looked up in the text instead
+  if (!cached)
+  {
+    codes.clear();
+    scenes.clear();
+    load_codes(config.c_str(), codes, &scenes);
+  }
   
   if (list_codes)
   {
@@ -262,64 +671,164 @@ int run_switch(int argc, char** argv)
       printf("  off: %s,%d,%d,%d,%d,%d\n",
              (*it).codes[1], (*it).values[1][0], (*it).values[1][1],
              (*it).values[1][2], (*it).values[1][3], (*it).values[1][4]);
+      print_airtime(*it);
       printf("  ---------------------------------------------------------------\n");
     }
     
+    for (list<SceneData>::iterator it=scenes.begin(); it != scenes.end(); it++) {
+      Timeline timeline;
+      
+      printf("  scene: %s =", (*it).name.c_str());
+      for (size_t m=0; m < (*it).members.size(); m++) {
+        printf(" %d:%s", (*it).members[m].id, (*it).members[m].action ? "off" : "on");
+      }
+      if (compile_scene(*it, codes, timeline) == RFE_NO_ERROR) {
+        printf(" (%.1f ms on air)", timeline.getDuration()/1e6);
+      }
+      printf("\n");
+    }
+    
   }
   
   else
   {
     
-    // Parse arguments
-    int i = 0;
-    for (int index=optind; index < argc; index++) {
-      if (i == 0) {
-        id = atoi(argv[index]);
-      } else if (i == 1) {
-        action = argv[index];
+    Timeline timeline;
+    
+    if (is_scene)
+    {
+      SceneData* scene = find_scene(scenes, target);
+      if (scene == NULL) {
+        return RFE_INVALID_ID;
+      }
+      
+      rc = compile_scene(*scene, codes, timeline);
+      if (rc != RFE_NO_ERROR) {
+        return rc;
       }
-      i++;
+      
+      printf("scene: %s (%d switches, %.1f ms airtime)\n", scene->name.c_str(),
+             (int)scene->members.size(), timeline.getDuration()/1e6);
     }
     
-    printf("action: %s\n", action.c_str());
-    
-    if (action.empty() || id < 0) {
-      return RFE_INCORRECT_ARGS;
+    else
+    {
+      printf("action: %s\n", action.c_str());
+      
+      id = target.empty() ? -1 : atoi(target.c_str());
+      
+      if (action.empty() || id < 0) {
+        return RFE_INCORRECT_ARGS;
+      }
+      
+      int a = get_action(action);
+      if (a < 0) {
+        return RFE_INVALID_ARGS;
+      }
+      
+      // Try to find the code
+      CodeData* cd = find_code(codes, id);
+      
+      // Have to have a code to continue
+      if (cd == NULL) {
+        return RFE_INVALID_ID;
+      }
+      
+      compile_code(*cd, a, timeline);
     }
     
-    if  (action != "on" && action != "off") {
+    Gpio* gpio = Gpio::create(backend.c_str());
+    if (gpio == NULL) {
       return RFE_INVALID_ARGS;
     }
     
-    CodeData* cd = NULL;
-    
-    // Try to find the code
-    for (list<CodeData>::iterator it = codes.begin(); it != codes.end() ; it++)
-    {
-      if ((*it).id == id) {
-        cd = &(*it);
-      }
+    rc = gpio->open(pin);
+    if (rc != RFE_NO_ERROR) {
+      delete gpio;
+      return rc;
     }
     
-    // Have to have a code to continue
-    if (cd == NULL) {
-      return RFE_INVALID_ID;
+    TimingTrace trace;
+    if (trace_timing) {
+      trace.prepare(timeline);
     }
     
-    // Set up gpi pointer for direct register access
-    int rc = setup_io();
-    if (rc != RFE_NO_ERROR) {
-      return rc;
+    // Wait for any other rfswitch to finish transmitting
+    timespec asked, granted;
+    Timeline::now(asked);
+    int lock = lock_transmitter();
+    Timeline::now(granted);
+    
+    if (lock < 0) {
+      printf("Warning: Can't take the transmit lock, other senders won't wait\n");
     }
     
-    // Switch GPIO PIN to output mode
-    INP_GPIO(PIN); // must use INP_GPIO before we can use OUT_GPIO
-    OUT_GPIO(PIN);
+    // Everything playback touches is allocated by now, so locking
+    // memory here faults it all in before the first edge
+    Realtime rt;
+    if (realtime) {
+      rt.enter(realtime_cpu);
+    }
     
     // Now we can finally send the code
-    send_code(cd, action);
+    int64_t airtime = play_timeline(timeline, *gpio, NULL, trace_timing ? &trace : NULL);
+    
+    rt.leave();
+    
+    unlock_transmitter(lock);
+    
+    int64_t queued = (granted.tv_sec - asked.tv_sec)*1000000000LL +
+                     (granted.tv_nsec - asked.tv_nsec);
+    
+    printf("sent: %d frames, %.1f ms airtime, queued %.1f ms\n", timeline.getFrames(),
+           airtime/1e6, queued/1e6);
+    
+    if (trace_timing) {
+      trace.report(stdout);
+      if (!trace_path.empty() && !trace.dump(trace_path.c_str())) {
+        printf("Error: Can't write %s\n", trace_path.c_str());
+      }
+    }
+    
+    gpio->close();
+    delete gpio;
     
   }
   
   return RFE_NO_ERROR;
-};
\ No newline at end of file
+};
+
+int run_compile(int argc, char** argv)
+{
+  string  config,
+          output;
+  int     c;
+  
+  while ((c = getopt(argc, argv, "hc:o:")) != -1)
+  {
+    switch (c)
+    {
+      case 'h':
+        return RFE_SHOW_HELP;
+      case 'c':
+        config = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        return RFE_INVALID_ARGS;
+    }
+  }
+  
+  int rc = find_config(config);
+  if (rc != RFE_NO_ERROR) {
+    return rc;
+  }
+  
+  if (output.empty()) {
+    output = CodeCache::getPath(config);
+  }
+  
+  return CodeCache::compile(config, output);
+};
@@ -1,5 +1,5 @@
 /**
- *  @file   switch.cpp
+ *  @file   switch.h
  *  @author Weston Nielson <wnielson@github>
  *
  */
@@ -7,6 +7,72 @@
 #ifndef __rfswitch__switch__
 #define __rfswitch__switch__
 
+#include "error.h"
+#include "Code.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <list>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Number of times each code is sent, unless its config says
+// otherwise
+#define REPEAT_COUNT 10
+
+// Frames sent beyond a code's ``min-frames``, in case one is lost
+#define REPEAT_MARGIN 2
+
+// Holds the transmit lock and the daemon socket.  Unlike /tmp,
+// nobody else can plant a symlink or a file of their own there.
+// Users who can't reach it fall back to RUN_USER_DIR under
+// $XDG_RUNTIME_DIR.
+#define RUN_DIR       "/run/rfswitch"
+#define RUN_USER_DIR  "rfswitch"
+
+// Held while transmitting, so separate rfswitch processes
+// take turns on the air instead of garbling each other
+#define TRANSMIT_LOCK "rfswitch.lock"
+
+class Gpio;
+class Timeline;
+class TimingTrace;
+
+struct CodeData {
+  int   id;
+  char  codes[2][MAX_CODE_BITS+1];
+  int   values[2][5];
+  int   repeats;      // Frames sent per command
+  int   min_frames;   // Frames the receiver needs to latch, or 0
+};
+
+// A named group of switches, e.g. ``scene livingroom = 1:on 2:on 5:off``
+struct SceneData {
+  string  name;
+  struct Member {
+    int   id;
+    int   action;   // 0 = on, 1 = off
+  };
+  vector<Member> members;
+};
+
+RF_ERROR    find_config(string& config);
+int         load_codes(const char* path, list<CodeData>& codes, list<SceneData>* scenes = NULL);
+CodeData*   find_code(list<CodeData>& codes, int id);
+SceneData*  find_scene(list<SceneData>& scenes, const string& name);
+int         get_action(const string& action);
+void        compile_code(const CodeData& cd, int action, Timeline& timeline);
+RF_ERROR    compile_scene(SceneData& scene, list<CodeData>& codes, Timeline& timeline);
+int64_t     play_timeline(Timeline& timeline, Gpio& gpio, int64_t* first_edge = NULL,
+                          TimingTrace* trace = NULL, const std::atomic<bool>* cancel = NULL,
+                          bool* cut_short = NULL);
+string      get_run_path(const char* name);
+int         lock_transmitter();
+void        unlock_transmitter(int fd);
+
 int run_switch(int argc, char **argv);
+int run_compile(int argc, char **argv);
 
 #endif /* defined(__rfswitch__switch__) */